@@ -0,0 +1,190 @@
+// Runs runSimulation() repeatedly over a corpus of layouts and prints timing results as JSON.
+//
+// Usage: reactorsim-bench [corpusDir] [--min-time seconds] [--min-iterations n]
+//
+// corpusDir (default bench/corpus) must contain an index.txt listing one grid file and its
+// category per line.  Results are only comparable between runs on the same machine.
+
+#include "../reactorsim.hpp"
+#include "../gridio.hpp"
+#include "../simstats.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+
+using namespace reactorsim;
+
+/***** Allocation counting *****/
+
+// Every heap allocation made by the process, through the replaced global operator new below.  The
+// array and sized forms fall back to these.
+static std::atomic<uint64_t> heapAllocations(0);
+
+void* operator new(size_t size) {
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if(!ptr) abort();	// built without exceptions, and a bench out of memory has nothing to report
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	free(ptr);
+}
+
+struct CorpusEntry {
+	std::string file;
+	std::string category;
+	std::vector<ComponentType> types;
+	int width;
+	int height;
+};
+
+struct BenchResult {
+	int simulations = 0;
+	double seconds = 0;
+	uint64_t ticks = 0;
+	uint64_t allocations = 0;	// heap allocations made by the simulations, of any kind
+	double p50Us = 0;
+	double p99Us = 0;
+	SimulationResults lastResults;
+};
+
+static std::vector<CorpusEntry> loadCorpus(const std::string& dir) {
+	std::vector<CorpusEntry> corpus;
+	std::ifstream index((dir + "/index.txt").c_str());
+	if(!index.good()) {
+		std::cerr << "Could not open " << dir << "/index.txt" << std::endl;
+		exit(1);
+	}
+	std::string line;
+	while(std::getline(index, line)) {
+		if(line.empty() || line[0] == '#') continue;
+		std::istringstream iss(line);
+		CorpusEntry entry;
+		if(!(iss >> entry.file >> entry.category)) continue;
+		loadTypesGrid(dir + "/" + entry.file, entry.types, entry.width, entry.height);
+		if(entry.height != 6 || entry.width < 3 || entry.width > 9 || (int)entry.types.size() != entry.width * entry.height) {
+			std::cerr << "Invalid grid in " << entry.file << std::endl;
+			exit(1);
+		}
+		corpus.push_back(entry);
+	}
+	return corpus;
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	if(sorted.empty()) return 0;
+	size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[idx];
+}
+
+static uint64_t sumRange(const StatsSnapshot& snap, int base, int count) {
+	uint64_t total = 0;
+	for(int i = 0; i < count; ++i) total += snap.values[base + i];
+	return total;
+}
+
+static BenchResult benchEntry(const CorpusEntry& entry, double minSeconds, int minIterations) {
+	BenchResult result;
+	std::vector<double> latencies;
+
+	// Warm up
+	{
+		Reactor reactor(entry.width - 3);
+		reactor.setComponentTypes(entry.types);
+		runSimulation(reactor);
+	}
+
+	resetStats();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(;;) {
+		std::chrono::steady_clock::time_point simStart = std::chrono::steady_clock::now();
+		uint64_t allocationsBefore = heapAllocations.load(std::memory_order_relaxed);
+		{
+			Reactor reactor(entry.width - 3);
+			reactor.setComponentTypes(entry.types);
+			result.lastResults = runSimulation(reactor);
+		}
+		// Before latencies grows
+		result.allocations += heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+		std::chrono::steady_clock::time_point simEnd = std::chrono::steady_clock::now();
+		latencies.push_back(std::chrono::duration<double, std::micro>(simEnd - simStart).count());
+		result.simulations++;
+		result.seconds = std::chrono::duration<double>(simEnd - start).count();
+		if(result.simulations >= minIterations && result.seconds >= minSeconds) break;
+	}
+	StatsSnapshot snap = collectStats();
+	result.ticks = sumRange(snap, STAT_TICKS, numStopReasons);
+
+	std::sort(latencies.begin(), latencies.end());
+	result.p50Us = percentile(latencies, 0.50);
+	result.p99Us = percentile(latencies, 0.99);
+	return result;
+}
+
+static void printResultJson(const BenchResult& r) {
+	std::cout << "\"simulations\": " << r.simulations
+		<< ", \"seconds\": " << r.seconds
+		<< ", \"ticksPerSimulation\": " << (double)r.ticks / r.simulations
+		<< ", \"ticksPerSec\": " << r.ticks / r.seconds
+		<< ", \"simulationsPerSec\": " << r.simulations / r.seconds
+		<< ", \"p50Us\": " << r.p50Us
+		<< ", \"p99Us\": " << r.p99Us
+		<< ", \"allocationsPerSimulation\": " << (double)r.allocations / r.simulations;
+}
+
+int main(int argc, char** argv) {
+	std::string corpusDir = "bench/corpus";
+	double minSeconds = 0.5;
+	int minIterations = 10;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--min-time" && i + 1 < argc) minSeconds = atof(argv[++i]);
+		else if(arg == "--min-iterations" && i + 1 < argc) minIterations = atoi(argv[++i]);
+		else corpusDir = arg;
+	}
+
+	std::vector<CorpusEntry> corpus = loadCorpus(corpusDir);
+
+	BenchResult total;
+	std::vector<double> medians;
+	std::cout << "{\n\t\"layouts\": [\n";
+	for(size_t i = 0; i < corpus.size(); ++i) {
+		BenchResult r = benchEntry(corpus[i], minSeconds, minIterations);
+		std::cout << "\t\t{ \"file\": \"" << corpus[i].file << "\", \"category\": \"" << corpus[i].category
+			<< "\", \"chambers\": " << corpus[i].width - 3 << ", \"mark\": " << r.lastResults.mark << ", ";
+		printResultJson(r);
+		std::cout << " }" << (i + 1 < corpus.size() ? "," : "") << "\n";
+
+		// The corpus pass weighs every layout equally: one simulation of each, with percentiles
+		// taken over the layouts' median latencies
+		total.simulations += 1;
+		total.seconds += r.seconds / r.simulations;
+		total.ticks += r.ticks / r.simulations;
+		total.allocations += r.allocations / r.simulations;
+		medians.push_back(r.p50Us);
+	}
+	std::sort(medians.begin(), medians.end());
+	total.p50Us = percentile(medians, 0.50);
+	total.p99Us = percentile(medians, 0.99);
+	std::cout << "\t],\n\t\"corpusPass\": { ";
+	printResultJson(total);
+	std::cout << " }\n}\n";
+	return 0;
+}
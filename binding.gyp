@@ -1,11 +1,59 @@
 {
+	"variables": {
+		"reactorsim_trace%": 0
+	},
 	"targets": [
 		{
 			"target_name": "nodereactorsim",
-			"sources": [ "node-reactorsim.cpp", "reactorsim.cpp", "gridio.cpp" ],
+			"sources": [ "node-reactorsim.cpp", "reactorsim.cpp", "gridio.cpp", "simtrace.cpp", "simstats.cpp", "dutycycle.cpp", "simcost.cpp", "symmetry.cpp", "resultsfile.cpp" ],
+			"defines": [ "NAPI_VERSION=6" ],
+			"cflags": [
+				"-std=c++11"
+			],
+			"conditions": [
+				[ "reactorsim_trace==1", { "defines": [ "REACTORSIM_TRACE" ] } ]
+			]
+		},
+		{
+			"target_name": "reactorsim-bench",
+			"type": "executable",
+			"sources": [ "bench/bench.cpp", "reactorsim.cpp", "gridio.cpp", "simtrace.cpp", "simstats.cpp" ],
+			"cflags": [
+				"-std=c++11"
+			]
+		},
+		{
+			"target_name": "reactorsim-verify",
+			"type": "executable",
+			"sources": [ "verify/verify.cpp", "verify/reference.cpp", "reactorsim.cpp", "gridio.cpp", "simtrace.cpp", "simstats.cpp", "symmetry.cpp" ],
 			"cflags": [
 				"-std=c++11"
 			]
 		}
+	],
+	"conditions": [
+		[ "OS!='win'", {
+			"targets": [
+				{
+					"target_name": "reactorsimd",
+					"type": "executable",
+					"sources": [ "daemon/reactorsimd.cpp", "daemon/protocol.cpp", "reactorsim.cpp", "gridio.cpp", "simtrace.cpp", "simstats.cpp", "symmetry.cpp" ],
+					"cflags": [
+						"-std=c++11", "-pthread"
+					],
+					"ldflags": [
+						"-pthread"
+					]
+				},
+				{
+					"target_name": "reactorsim-client",
+					"type": "static_library",
+					"sources": [ "daemon/client.cpp", "daemon/protocol.cpp" ],
+					"cflags": [
+						"-std=c++11"
+					]
+				}
+			]
+		} ]
 	]
 }
@@ -0,0 +1,134 @@
+#include "client.hpp"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0	// macOS uses SO_NOSIGPIPE instead
+#endif
+
+namespace reactorsim {
+
+DaemonClient::DaemonClient() : fd(-1), nextRequestId(1) {
+}
+
+DaemonClient::~DaemonClient() {
+	close();
+}
+
+bool DaemonClient::connect(const std::string& path, std::string& error) {
+	close();
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) {
+		error = "Socket path too long: " + path;
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		error = "Could not connect to " + path + ": " + strerror(errno);
+		close();
+		return false;
+	}
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	return true;
+}
+
+void DaemonClient::close() {
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+	in.clear();
+	pending.clear();
+}
+
+uint32_t DaemonClient::send(const PackedLayouts& layouts, const SimulationOptions& options) {
+	if(fd < 0) return 0;
+	uint32_t requestId = nextRequestId++;
+	if(!nextRequestId) nextRequestId = 1;
+	std::vector<uint8_t> frame;
+	protocol::encodeRequest(frame, requestId, layouts, options);
+	if(frame.size() - 4 > protocol::maxFrameSize) return 0;	// the daemon would drop the connection
+	size_t pos = 0;
+	while(pos < frame.size()) {
+		ssize_t n = ::send(fd, &frame[pos], frame.size() - pos, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) {
+			close();
+			return 0;
+		}
+		pos += n;
+	}
+	return requestId;
+}
+
+bool DaemonClient::receive(protocol::Response& response, std::string& error) {
+	if(!pending.empty()) {
+		response = pending.begin()->second;
+		pending.erase(pending.begin());
+		return true;
+	}
+	for(;;) {
+		if(in.size() >= 4) {
+			uint32_t length;
+			memcpy(&length, &in[0], 4);
+			if(in.size() - 4 >= length) {
+				bool ok = protocol::decodeResponse(&in[4], length, response);
+				in.erase(in.begin(), in.begin() + 4 + length);
+				if(!ok) {
+					error = "Malformed response from daemon";
+					close();
+				}
+				return ok;
+			}
+		}
+		if(fd < 0) {
+			error = "Not connected to daemon";
+			return false;
+		}
+		uint8_t buf[65536];
+		ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) {
+			error = n == 0 ? "Daemon closed the connection" : std::string("Could not read from daemon: ") + strerror(errno);
+			close();
+			return false;
+		}
+		in.insert(in.end(), buf, buf + n);
+	}
+}
+
+bool DaemonClient::simulate(const PackedLayouts& layouts, const SimulationOptions& options, std::vector<SimulationResults>& results, std::string& error) {
+	if(protocol::requestHeaderSize + layouts.size() + layouts.types.size() - 4 > protocol::maxFrameSize) {
+		error = "Too many layouts for one request";
+		return false;
+	}
+	uint32_t requestId = send(layouts, options);
+	if(!requestId) {
+		error = "Could not send to daemon";
+		return false;
+	}
+	std::map<uint32_t, protocol::Response> earlier;
+	earlier.swap(pending);
+	protocol::Response response;
+	bool ok;
+	while((ok = receive(response, error)) && response.requestId != requestId) {
+		earlier[response.requestId] = response;
+	}
+	pending.swap(earlier);
+	if(!ok) return false;
+	if(!response.ok) {
+		error = response.error;
+		return false;
+	}
+	results.swap(response.results);
+	return true;
+}
+
+}
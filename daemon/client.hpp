@@ -0,0 +1,46 @@
+#ifndef REACTORSIM_DAEMON_CLIENT_HPP
+#define REACTORSIM_DAEMON_CLIENT_HPP
+
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdint>
+#include "protocol.hpp"
+
+namespace reactorsim {
+
+// Blocking client of reactorsimd.  Requests may be pipelined: send() any number of them, then
+// receive() their responses in completion order.  Not thread safe.
+class DaemonClient {
+public:
+	DaemonClient();
+	~DaemonClient();
+
+	bool connect(const std::string& path, std::string& error);
+	void close();
+	bool isConnected() const { return fd >= 0; }
+
+	// Sends a request and returns its requestId, or 0 if the connection failed or the request is
+	// larger than protocol::maxFrameSize
+	uint32_t send(const PackedLayouts& layouts, const SimulationOptions& options = SimulationOptions());
+
+	// Waits for the next response.  Returns false and sets error if the connection failed.
+	bool receive(protocol::Response& response, std::string& error);
+
+	// Simulates layouts and waits for their results, one per layout.  Responses to other requests
+	// that arrive meanwhile are kept for receive().
+	bool simulate(const PackedLayouts& layouts, const SimulationOptions& options, std::vector<SimulationResults>& results, std::string& error);
+
+private:
+	DaemonClient(const DaemonClient&);
+	DaemonClient& operator=(const DaemonClient&);
+
+	int fd;
+	uint32_t nextRequestId;
+	std::vector<uint8_t> in;
+	std::map<uint32_t, protocol::Response> pending;	// received but not yet returned
+};
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include "protocol.hpp"
+#include "../resultsfile.hpp"
+#include <cstring>
+
+namespace reactorsim {
+namespace protocol {
+
+namespace {
+
+template<class T>
+void put(std::vector<uint8_t>& out, T value) {
+	size_t pos = out.size();
+	out.resize(pos + sizeof(T));
+	memcpy(&out[pos], &value, sizeof(T));
+}
+
+template<class T>
+void write(uint8_t* out, T value) {
+	memcpy(out, &value, sizeof(T));
+}
+
+template<class T>
+T read(const uint8_t* in) {
+	T value;
+	memcpy(&value, in, sizeof(T));
+	return value;
+}
+
+// Sets the length word at the start of the frame beginning at start
+void finishFrame(std::vector<uint8_t>& out, size_t start) {
+	write<uint32_t>(&out[start], out.size() - start - 4);
+}
+
+}
+
+void encodeResults(const SimulationResults& results, uint8_t* record) {
+	write<float>(record, results.efficiency);
+	write<float>(record + 4, results.totalEUPerCycle);
+	write<int32_t>(record + 8, results.euPerTick);
+	write<int32_t>(record + 12, results.overallEUPerTick);
+	write<int32_t>(record + 16, results.cooldownTicks);
+	write<int32_t>(record + 20, results.cycleTicks);
+	write<int32_t>(record + 24, results.numIterationsBeforeFailure);
+	write<int32_t>(record + 28, results.ticksUntilMeltdown);
+	write<int32_t>(record + 32, results.ticksUntilComponentFailure);
+	write<int32_t>(record + 36, results.totalCost);
+	record[40] = (uint8_t)(int8_t)results.mark;
+	record[41] = (results.usesSingleUseCoolant ? RESULTS_USES_SINGLE_USE_COOLANT : 0) | (results.timedOut ? RESULTS_TIMED_OUT : 0) |
+		(results.incomplete ? RESULTS_INCOMPLETE : 0);
+	record[42] = results.rejected;
+	record[43] = 0;
+}
+
+void decodeResults(const uint8_t* record, SimulationResults& results) {
+	results.efficiency = read<float>(record);
+	results.totalEUPerCycle = read<float>(record + 4);
+	results.euPerTick = read<int32_t>(record + 8);
+	results.overallEUPerTick = read<int32_t>(record + 12);
+	results.cooldownTicks = read<int32_t>(record + 16);
+	results.cycleTicks = read<int32_t>(record + 20);
+	results.numIterationsBeforeFailure = read<int32_t>(record + 24);
+	results.ticksUntilMeltdown = read<int32_t>(record + 28);
+	results.ticksUntilComponentFailure = read<int32_t>(record + 32);
+	results.totalCost = read<int32_t>(record + 36);
+	results.mark = (int8_t)record[40];
+	results.usesSingleUseCoolant = (record[41] & RESULTS_USES_SINGLE_USE_COOLANT) != 0;
+	results.timedOut = (record[41] & RESULTS_TIMED_OUT) != 0;
+	results.incomplete = (record[41] & RESULTS_INCOMPLETE) != 0;
+	results.rejected = (RejectReason)record[42];
+}
+
+void encodeRequest(std::vector<uint8_t>& out, uint32_t requestId, const PackedLayouts& layouts, const SimulationOptions& options) {
+	size_t start = out.size();
+	put<uint32_t>(out, 0);
+	put<uint32_t>(out, requestId);
+	put<uint16_t>(out, protocolVersion);
+	put<uint16_t>(out, options.exactCycles ? REQUEST_EXACT_CYCLES : 0);
+	put<uint32_t>(out, layouts.size());
+	put<int32_t>(out, options.maxCycles);
+	put<int32_t>(out, options.thresholds.minEUPerTick);
+	put<int32_t>(out, options.thresholds.minOverallEUPerTick);
+	put<int32_t>(out, options.thresholds.maxMark);
+	out.insert(out.end(), layouts.widths.begin(), layouts.widths.end());
+	out.insert(out.end(), layouts.types.begin(), layouts.types.end());
+	finishFrame(out, start);
+}
+
+bool decodeRequest(const uint8_t* frame, size_t length, Request& request, std::string& error) {
+	if(length < 4) {
+		error = "Truncated request";
+		return false;
+	}
+	request.requestId = read<uint32_t>(frame);
+	if(length < requestHeaderSize - 4) {
+		error = "Truncated request";
+		return false;
+	}
+	if(read<uint16_t>(frame + 4) != protocolVersion) {
+		error = "Unsupported protocol version";
+		return false;
+	}
+	uint16_t flags = read<uint16_t>(frame + 6);
+	uint32_t count = read<uint32_t>(frame + 8);
+	request.options.exactCycles = (flags & REQUEST_EXACT_CYCLES) != 0;
+	request.options.maxCycles = read<int32_t>(frame + 12);
+	request.options.thresholds.minEUPerTick = read<int32_t>(frame + 16);
+	request.options.thresholds.minOverallEUPerTick = read<int32_t>(frame + 20);
+	request.options.thresholds.maxMark = read<int32_t>(frame + 24);
+	if(request.options.maxCycles < 1) {
+		error = "maxCycles must be positive";
+		return false;
+	}
+
+	const uint8_t* widths = frame + requestHeaderSize - 4;
+	const uint8_t* end = frame + length;
+	if(count > (size_t)(end - widths)) {
+		error = "Truncated request";
+		return false;
+	}
+	const uint8_t* types = widths + count;
+	size_t numCells = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		if(widths[i] < 3 || widths[i] > 9) {
+			error = "Invalid width of layout " + std::to_string(i);
+			return false;
+		}
+		numCells += widths[i] * 6;
+	}
+	if(numCells != (size_t)(end - types)) {
+		error = "Request length does not match its layouts";
+		return false;
+	}
+	for(size_t i = 0; i < numCells; ++i) {
+		if(types[i] >= COMPONENT_COUNT) {
+			error = "Invalid component type " + std::to_string(types[i]);
+			return false;
+		}
+	}
+	request.layouts.widths.assign(widths, types);
+	request.layouts.types.assign(types, end);
+	request.layouts.lines.assign(count, 0);
+	return true;
+}
+
+void encodeResponse(std::vector<uint8_t>& out, uint32_t requestId, const std::vector<SimulationResults>& results) {
+	size_t start = out.size();
+	put<uint32_t>(out, 0);
+	put<uint32_t>(out, requestId);
+	put<uint16_t>(out, RESPONSE_OK);
+	put<uint16_t>(out, 0);
+	put<uint32_t>(out, results.size());
+	size_t pos = out.size();
+	out.resize(pos + results.size() * resultRecordSize);
+	for(const SimulationResults& r : results) {
+		encodeResults(r, &out[pos]);
+		pos += resultRecordSize;
+	}
+	finishFrame(out, start);
+}
+
+void encodeErrorResponse(std::vector<uint8_t>& out, uint32_t requestId, const std::string& message) {
+	size_t start = out.size();
+	put<uint32_t>(out, 0);
+	put<uint32_t>(out, requestId);
+	put<uint16_t>(out, RESPONSE_ERROR);
+	put<uint16_t>(out, 0);
+	put<uint32_t>(out, 0);
+	out.insert(out.end(), message.begin(), message.end());
+	finishFrame(out, start);
+}
+
+bool decodeResponse(const uint8_t* frame, size_t length, Response& response) {
+	if(length < responseHeaderSize - 4) return false;
+	response.requestId = read<uint32_t>(frame);
+	response.ok = read<uint16_t>(frame + 4) == RESPONSE_OK;
+	uint32_t count = read<uint32_t>(frame + 8);
+	const uint8_t* body = frame + responseHeaderSize - 4;
+	size_t bodyLength = length - (responseHeaderSize - 4);
+	if(!response.ok) {
+		response.error.assign((const char*)body, bodyLength);
+		return true;
+	}
+	if(bodyLength != (size_t)count * resultRecordSize) return false;
+	response.results.resize(count);
+	for(uint32_t i = 0; i < count; ++i) {
+		decodeResults(body + i * resultRecordSize, response.results[i]);
+	}
+	return true;
+}
+
+}
+}
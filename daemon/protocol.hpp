@@ -0,0 +1,91 @@
+#ifndef REACTORSIM_PROTOCOL_HPP
+#define REACTORSIM_PROTOCOL_HPP
+
+// Binary protocol of reactorsimd, spoken over a Unix domain socket.  All integers are little endian.
+//
+// Request frame:
+//   uint32 length of the rest of the frame
+//   uint32 requestId, chosen by the client and echoed in the response
+//   uint16 version (protocolVersion)
+//   uint16 flags (REQUEST_EXACT_CYCLES)
+//   uint32 count of layouts
+//   int32 maxCycles, minEUPerTick, minOverallEUPerTick, maxMark
+//   uint8 width of each layout (3 to 9), then the ComponentType of every cell, row-major, layout
+//   after layout (packed like PackedLayouts)
+// Response frame:
+//   uint32 length of the rest of the frame
+//   uint32 requestId
+//   uint16 status (RESPONSE_OK or RESPONSE_ERROR)
+//   uint16 0
+//   uint32 count of results
+//   a resultRecordSize record per layout, in request order, or the UTF-8 message of an error
+//
+// Clients may send any number of requests without waiting for responses, which arrive in whatever
+// order they complete.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "../reactorsim.hpp"
+#include "../gridio.hpp"
+
+namespace reactorsim {
+namespace protocol {
+
+static const char* const defaultSocketPath = "/tmp/reactorsimd.sock";
+static const uint16_t protocolVersion = 1;
+static const uint32_t maxFrameSize = 64 << 20;
+static const size_t requestHeaderSize = 32;		// including the length
+static const size_t responseHeaderSize = 16;	// including the length
+
+enum RequestFlag {
+	REQUEST_EXACT_CYCLES = 1
+};
+
+enum ResponseStatus {
+	RESPONSE_OK,
+	RESPONSE_ERROR
+};
+
+// Record of one SimulationResults:
+//   float32 efficiency, totalEUPerCycle
+//   int32 euPerTick, overallEUPerTick, cooldownTicks, cycleTicks, numIterationsBeforeFailure,
+//         ticksUntilMeltdown, ticksUntilComponentFailure, totalCost
+//   int8 mark
+//   uint8 flags (ResultsFlag bits of resultsfile.hpp), rejectReason, 0
+static const size_t resultRecordSize = 44;
+
+void encodeResults(const SimulationResults& results, uint8_t* record);
+void decodeResults(const uint8_t* record, SimulationResults& results);
+
+// Appends a whole request frame to out
+void encodeRequest(std::vector<uint8_t>& out, uint32_t requestId, const PackedLayouts& layouts, const SimulationOptions& options);
+
+struct Request {
+	uint32_t requestId = 0;
+	SimulationOptions options;
+	PackedLayouts layouts;
+};
+
+// Decodes a request frame, without its length word.  Returns false and sets error if it is invalid;
+// requestId is set if the frame was long enough to hold it.
+bool decodeRequest(const uint8_t* frame, size_t length, Request& request, std::string& error);
+
+// Appends a whole response frame to out
+void encodeResponse(std::vector<uint8_t>& out, uint32_t requestId, const std::vector<SimulationResults>& results);
+void encodeErrorResponse(std::vector<uint8_t>& out, uint32_t requestId, const std::string& message);
+
+struct Response {
+	uint32_t requestId = 0;
+	bool ok = false;
+	std::string error;
+	std::vector<SimulationResults> results;
+};
+
+// Decodes a response frame, without its length word.  Returns false if it is malformed.
+bool decodeResponse(const uint8_t* frame, size_t length, Response& response);
+
+}
+}
+
+#endif
@@ -0,0 +1,414 @@
+// Simulation daemon: serves runSimulation() over a Unix domain socket to any number of clients,
+// with a warm thread pool and a cache of results.  See protocol.hpp for the protocol.
+//
+// Usage: reactorsimd [--socket path] [--threads n] [--cache entries]
+//
+// One thread runs a poll() loop over the listening socket and the connections, and decodes
+// requests into one task per layout for the pool.  Layouts proven equivalent (see symmetry.hpp)
+// share cache entries.  The results of a request are sent back once all of its layouts are done;
+// tasks of a client that has disconnected are dropped.  A client that only shuts down its sending
+// side still receives the responses to the requests it sent.
+
+#include "protocol.hpp"
+#include "../reactorsim.hpp"
+#include "../symmetry.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace reactorsim;
+using namespace reactorsim::protocol;
+
+
+/***** Result cache *****/
+
+// Least recently used results, by layout and options
+class ResultCache {
+public:
+	ResultCache(size_t capacity) : capacity(capacity) {}
+
+	bool get(const std::string& key, SimulationResults& results) {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<std::string, std::list<Entry>::iterator>::iterator itr = index.find(key);
+		if(itr == index.end()) return false;
+		entries.splice(entries.begin(), entries, itr->second);
+		results = itr->second->second;
+		return true;
+	}
+
+	void put(const std::string& key, const SimulationResults& results) {
+		if(!capacity) return;
+		std::lock_guard<std::mutex> lock(mutex);
+		if(index.count(key)) return;
+		entries.push_front(Entry(key, results));
+		index[key] = entries.begin();
+		if(entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+private:
+	typedef std::pair<std::string, SimulationResults> Entry;
+	size_t capacity;
+	std::mutex mutex;
+	std::list<Entry> entries;	// most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+std::vector<ComponentType> getLayout(const unsigned char* types, int width) {
+	std::vector<ComponentType> layout(width * 6);
+	for(size_t i = 0; i < layout.size(); ++i) layout[i] = (ComponentType)types[i];
+	return layout;
+}
+
+std::string getCacheKey(const std::vector<ComponentType>& types, int width, const SimulationOptions& options) {
+	std::vector<ComponentType> canonical = canonicalizeLayout(types, width, 6);
+	std::string key(1, (char)width);
+	for(ComponentType type : canonical) key.push_back((char)type);
+	key += options.exactCycles ? "e" + std::to_string(options.maxCycles) : "-";
+	const SimulationThresholds& thresholds = options.thresholds;
+	key += "t" + std::to_string(thresholds.minEUPerTick) + "," + std::to_string(thresholds.minOverallEUPerTick) + "," + std::to_string(thresholds.maxMark);
+	return key;
+}
+
+
+/***** Jobs *****/
+
+// A request being simulated
+struct Job {
+	uint64_t connectionId;
+	std::shared_ptr<std::atomic<bool>> disconnected;	// shared with the connection
+	Request request;
+	std::vector<size_t> offsets;	// of each layout in request.layouts.types
+	std::vector<std::string> keys;
+	std::vector<SimulationResults> results;
+	std::atomic<uint32_t> remaining;
+};
+
+struct Task {
+	std::shared_ptr<Job> job;
+	uint32_t index;
+};
+
+// Runs tasks on a fixed set of threads, and hands finished jobs back to the poll loop through a pipe
+class WorkerPool {
+public:
+	WorkerPool(int numThreads, ResultCache& cache, int wakeFd) : cache(cache), wakeFd(wakeFd), stopping(false) {
+		for(int i = 0; i < numThreads; ++i) threads.emplace_back(&WorkerPool::run, this);
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(std::thread& thread : threads) thread.join();
+	}
+
+	void push(const std::vector<Task>& newTasks) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.insert(tasks.end(), newTasks.begin(), newTasks.end());
+		}
+		wake.notify_all();
+	}
+
+	// Called when the last layout of a job is done, on whichever thread did it
+	void finish(const std::shared_ptr<Job>& job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back(job);
+		}
+		char byte = 0;
+		while(write(wakeFd, &byte, 1) < 0 && errno == EINTR) {}
+	}
+
+	std::vector<std::shared_ptr<Job>> takeFinished() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<std::shared_ptr<Job>> jobs;
+		jobs.swap(finished);
+		return jobs;
+	}
+
+private:
+	void run() {
+		for(;;) {
+			Task task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if(stopping) return;
+				task = tasks.front();
+				tasks.pop_front();
+			}
+			Job& job = *task.job;
+			SimulationResults& results = job.results[task.index];
+			if(*job.disconnected) {
+				results.incomplete = true;
+			} else {
+				int width = job.request.layouts.widths[task.index];
+				const unsigned char* types = &job.request.layouts.types[job.offsets[task.index]];
+				Reactor reactor(width - 3);
+				reactor.setComponentTypes(getLayout(types, width));
+				results = runSimulation(reactor, job.request.options);
+				cache.put(job.keys[task.index], results);
+			}
+			if(--job.remaining == 0) finish(task.job);
+		}
+	}
+
+	ResultCache& cache;
+	int wakeFd;
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Task> tasks;
+	std::vector<std::shared_ptr<Job>> finished;
+	bool stopping;
+};
+
+
+/***** Connections *****/
+
+struct Connection {
+	int fd;
+	std::shared_ptr<std::atomic<bool>> disconnected;
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> out;
+	size_t outPos = 0;
+	uint32_t pendingJobs = 0;	// requests not yet answered
+	bool inputClosed = false;	// the client shut down its side; closed once answered
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static int signalWakeFd = -1;
+
+static void onSignal(int) {
+	stopRequested = 1;
+	char byte = 0;
+	ssize_t ignored = write(signalWakeFd, &byte, 1);
+	(void)ignored;
+}
+
+static void setNonBlocking(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Starts simulating a request, answering at once from the cache where possible
+static void handleRequest(Connection& conn, uint64_t connectionId, const uint8_t* frame, size_t length, WorkerPool& pool, ResultCache& cache) {
+	std::shared_ptr<Job> job(new Job());
+	std::string error;
+	if(!decodeRequest(frame, length, job->request, error)) {
+		encodeErrorResponse(conn.out, job->request.requestId, error);
+		return;
+	}
+	job->connectionId = connectionId;
+	job->disconnected = conn.disconnected;
+	conn.pendingJobs++;
+	PackedLayouts& layouts = job->request.layouts;
+	uint32_t count = layouts.size();
+	job->results.resize(count);
+	job->keys.resize(count);
+	// One extra count held until every task is queued, so that the job cannot finish early
+	job->remaining = count + 1;
+	std::vector<Task> tasks;
+	size_t offset = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		int width = layouts.widths[i];
+		job->offsets.push_back(offset);
+		job->keys[i] = getCacheKey(getLayout(&layouts.types[offset], width), width, job->request.options);
+		offset += width * 6;
+		if(cache.get(job->keys[i], job->results[i])) {
+			job->remaining--;
+		} else {
+			Task task = { job, i };
+			tasks.push_back(task);
+		}
+	}
+	pool.push(tasks);
+	if(--job->remaining == 0) pool.finish(job);
+}
+
+// Decodes every complete frame received.  Returns false if the connection must be closed.
+static bool readFrames(Connection& conn, uint64_t connectionId, WorkerPool& pool, ResultCache& cache) {
+	size_t pos = 0;
+	while(conn.in.size() - pos >= 4) {
+		uint32_t length;
+		memcpy(&length, &conn.in[pos], 4);
+		if(length > maxFrameSize) return false;
+		if(conn.in.size() - pos - 4 < length) break;
+		handleRequest(conn, connectionId, &conn.in[pos + 4], length, pool, cache);
+		pos += 4 + length;
+	}
+	conn.in.erase(conn.in.begin(), conn.in.begin() + pos);
+	return true;
+}
+
+static int listenOn(const std::string& path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: " << path << std::endl;
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	// A socket file left by a daemon that is no longer running is replaced
+	if(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+		std::cerr << "A daemon is already listening on " << path << std::endl;
+		close(fd);
+		return -1;
+	}
+	unlink(path.c_str());
+	if(bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+		perror(path.c_str());
+		close(fd);
+		return -1;
+	}
+	setNonBlocking(fd);
+	return fd;
+}
+
+
+int main(int argc, char** argv) {
+	std::string socketPath = defaultSocketPath;
+	int numThreads = std::thread::hardware_concurrency();
+	long cacheSize = 100000;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--socket" && i + 1 < argc) socketPath = argv[++i];
+		else if(arg == "--threads" && i + 1 < argc) numThreads = atoi(argv[++i]);
+		else if(arg == "--cache" && i + 1 < argc) cacheSize = atol(argv[++i]);
+		else {
+			std::cerr << "Usage: reactorsimd [--socket path] [--threads n] [--cache entries]" << std::endl;
+			return 2;
+		}
+	}
+	if(numThreads < 1) numThreads = 1;
+	if(cacheSize < 0) cacheSize = 0;
+
+	int listenFd = listenOn(socketPath);
+	if(listenFd < 0) return 1;
+	int wakePipe[2];
+	if(pipe(wakePipe) != 0) {
+		perror("pipe");
+		return 1;
+	}
+	setNonBlocking(wakePipe[0]);
+	setNonBlocking(wakePipe[1]);
+	signalWakeFd = wakePipe[1];
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	ResultCache cache(cacheSize);
+	WorkerPool pool(numThreads, cache, wakePipe[1]);
+	std::unordered_map<uint64_t, Connection> connections;
+	uint64_t nextConnectionId = 1;
+	std::cerr << "reactorsimd listening on " << socketPath << " with " << numThreads << " threads" << std::endl;
+
+	std::vector<pollfd> fds;
+	std::vector<uint64_t> fdConnections;
+	while(!stopRequested) {
+		fds.clear();
+		fdConnections.clear();
+		fds.push_back({ listenFd, POLLIN, 0 });
+		fds.push_back({ wakePipe[0], POLLIN, 0 });
+		for(std::pair<const uint64_t, Connection>& entry : connections) {
+			Connection& conn = entry.second;
+			fds.push_back({ conn.fd, (short)((conn.inputClosed ? 0 : POLLIN) | (conn.outPos < conn.out.size() ? POLLOUT : 0)), 0 });
+			fdConnections.push_back(entry.first);
+		}
+		if(poll(&fds[0], fds.size(), -1) < 0) {
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int fd;
+			while((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+				setNonBlocking(fd);
+				Connection& conn = connections[nextConnectionId++];
+				conn.fd = fd;
+				conn.disconnected.reset(new std::atomic<bool>(false));
+			}
+		}
+
+		if(fds[1].revents & POLLIN) {
+			char buf[256];
+			while(read(wakePipe[0], buf, sizeof(buf)) > 0) {}
+			for(const std::shared_ptr<Job>& job : pool.takeFinished()) {
+				std::unordered_map<uint64_t, Connection>::iterator itr = connections.find(job->connectionId);
+				if(itr == connections.end()) continue;
+				encodeResponse(itr->second.out, job->request.requestId, job->results);
+				itr->second.pendingJobs--;
+			}
+		}
+
+		for(size_t i = 2; i < fds.size(); ++i) {
+			uint64_t connectionId = fdConnections[i - 2];
+			Connection& conn = connections[connectionId];
+			bool open = true;
+			if(fds[i].revents & POLLERR) {
+				open = false;
+			} else if(!conn.inputClosed && (fds[i].revents & (POLLIN | POLLHUP))) {
+				uint8_t buf[65536];
+				ssize_t n;
+				while((n = read(conn.fd, buf, sizeof(buf))) > 0) conn.in.insert(conn.in.end(), buf, buf + n);
+				if(n == 0) conn.inputClosed = true;
+				else if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) open = false;
+				if(!readFrames(conn, connectionId, pool, cache)) open = false;
+			} else if(conn.inputClosed && (fds[i].revents & POLLHUP)) {
+				open = false;	// nobody left to answer
+			}
+			while(open && conn.outPos < conn.out.size()) {
+				ssize_t n = write(conn.fd, &conn.out[conn.outPos], conn.out.size() - conn.outPos);
+				if(n < 0) {
+					if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) open = false;
+					break;
+				}
+				conn.outPos += n;
+			}
+			if(conn.outPos == conn.out.size()) {
+				conn.out.clear();
+				conn.outPos = 0;
+				if(conn.inputClosed && !conn.pendingJobs) open = false;
+			}
+			if(!open) {
+				*conn.disconnected = true;
+				close(conn.fd);
+				connections.erase(connectionId);
+			}
+		}
+	}
+
+	for(std::pair<const uint64_t, Connection>& entry : connections) close(entry.second.fd);
+	close(listenFd);
+	unlink(socketPath.c_str());
+	return 0;
+}
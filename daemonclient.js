@@ -0,0 +1,227 @@
+// Client of reactorsimd, the simulation daemon built with the addon.  Requests are pipelined over
+// one connection and answered in completion order.  See daemon/protocol.hpp for the protocol.
+
+var net = require('net');
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+
+var PROTOCOL_VERSION = 1;
+var REQUEST_EXACT_CYCLES = 1;
+var RESPONSE_OK = 0;
+var RESULT_RECORD_SIZE = 44;
+var REQUEST_HEADER_SIZE = 32;	// including the length
+var MAX_FRAME_SIZE = 64 << 20;	// not counting the length; larger requests are split
+var DEFAULT_SOCKET_PATH = '/tmp/reactorsimd.sock';
+
+var FLAG_USES_SINGLE_USE_COOLANT = 1;
+var FLAG_TIMED_OUT = 2;
+var FLAG_INCOMPLETE = 4;
+var rejectReasonNames = [ 'none', 'euPerTick', 'overallEUPerTick', 'mark' ];
+
+// A connection to the daemon.  Emits 'error' and 'close'; once closed, every call still waiting
+// receives an error.
+function DaemonClient(socket, codes) {
+	EventEmitter.call(this);
+	var self = this;
+	this._socket = socket;
+	this._codes = codes;
+	this._nextRequestId = 1;
+	this._callbacks = {};	// by requestId
+	this._chunks = [];	// received and not yet decoded
+	this._buffered = 0;
+	this._closed = false;
+	socket.on('data', function(data) { self._onData(data); });
+	socket.on('error', function(error) { self._fail(error); });
+	socket.on('close', function() {
+		self._fail(new Error('Daemon connection closed'));
+		self.emit('close');
+	});
+}
+util.inherits(DaemonClient, EventEmitter);
+
+// Packs layouts, given as arrays of component codes, the way loadGridFile returns them
+DaemonClient.prototype._pack = function(layouts) {
+	var codes = this._codes;
+	var widths = new Uint8Array(layouts.length);
+	var numCells = 0;
+	layouts.forEach(function(layout, i) {
+		if(!Array.isArray(layout) || layout.length % 6 !== 0 || layout.length < 3 * 6 || layout.length > 9 * 6) {
+			throw new TypeError('Invalid number of components in layout ' + i);
+		}
+		widths[i] = layout.length / 6;
+		numCells += layout.length;
+	});
+	var types = new Uint8Array(numCells);
+	var pos = 0;
+	layouts.forEach(function(layout) {
+		layout.forEach(function(code) {
+			var type = codes.indexOf(code);
+			if(type < 0) throw new TypeError('Invalid component code: ' + code);
+			types[pos++] = type;
+		});
+	});
+	return { widths: widths, types: types };
+};
+
+// Simulates layouts on the daemon.  layouts is an array of layouts as for runSimulation(), or
+// { widths, types } as loadGridFile returns.  options takes exactCycles, maxCycles and thresholds as
+// for runSimulation().  callback(error, results) receives an array of results, one per layout.
+// Layouts that do not fit in one request are sent as several.
+DaemonClient.prototype.simulate = function(layouts, options, callback) {
+	if(typeof options === 'function') {
+		callback = options;
+		options = {};
+	}
+	options = options || {};
+	if(this._closed) {
+		process.nextTick(callback, new Error('Daemon connection closed'));
+		return;
+	}
+	var packed = Array.isArray(layouts) ? this._pack(layouts) : layouts;
+	var count = packed.widths.length;
+	var parts = [];
+	var start = 0, cellStart = 0, cellEnd = 0;
+	for(var i = 0; i < count; i++) {
+		var cells = packed.widths[i] * 6;
+		if(i > start && REQUEST_HEADER_SIZE - 4 + (i + 1 - start) + (cellEnd + cells - cellStart) > MAX_FRAME_SIZE) {
+			parts.push({ widths: packed.widths.subarray(start, i), types: packed.types.subarray(cellStart, cellEnd) });
+			start = i;
+			cellStart = cellEnd;
+		}
+		cellEnd += cells;
+	}
+	parts.push({ widths: packed.widths.subarray(start), types: packed.types.subarray(cellStart, cellEnd) });
+	if(parts.length === 1) return this._send(packed, options, callback);
+
+	var results = new Array(parts.length), remaining = parts.length, failed = false;
+	parts.forEach(function(part, p) {
+		this._send(part, options, function(error, partResults) {
+			if(failed) return;
+			if(error) {
+				failed = true;
+				return callback(error);
+			}
+			results[p] = partResults;
+			if(--remaining === 0) callback(null, Array.prototype.concat.apply([], results));
+		});
+	}, this);
+};
+
+// Sends one request frame
+DaemonClient.prototype._send = function(packed, options, callback) {
+	var thresholds = options.thresholds || {};
+	var count = packed.widths.length;
+	var frame = Buffer.alloc(REQUEST_HEADER_SIZE + count + packed.types.length);
+	var requestId = this._nextRequestId;
+	this._nextRequestId = (this._nextRequestId % 0xffffffff) + 1;
+	frame.writeUInt32LE(frame.length - 4, 0);
+	frame.writeUInt32LE(requestId, 4);
+	frame.writeUInt16LE(PROTOCOL_VERSION, 8);
+	frame.writeUInt16LE(options.exactCycles ? REQUEST_EXACT_CYCLES : 0, 10);
+	frame.writeUInt32LE(count, 12);
+	frame.writeInt32LE(options.maxCycles !== undefined ? options.maxCycles : 1000, 16);
+	frame.writeInt32LE(thresholds.minEUPerTick || 0, 20);
+	frame.writeInt32LE(thresholds.minOverallEUPerTick || 0, 24);
+	frame.writeInt32LE(thresholds.maxMark !== undefined ? thresholds.maxMark : 5, 28);
+	frame.set(packed.widths, REQUEST_HEADER_SIZE);
+	frame.set(packed.types, REQUEST_HEADER_SIZE + count);
+	this._callbacks[requestId] = callback;
+	this._socket.write(frame);
+};
+
+DaemonClient.prototype.close = function() {
+	this._socket.end();
+};
+
+// Chunks are only joined once the next frame is complete, so that a large response arriving in
+// many chunks is copied once rather than once per chunk
+DaemonClient.prototype._onData = function(data) {
+	this._chunks.push(data);
+	this._buffered += data.length;
+	if(this._buffered < 4) return;
+	if(this._chunks[0].length < 4) this._chunks = [ Buffer.concat(this._chunks) ];
+	if(this._buffered - 4 < this._chunks[0].readUInt32LE(0)) return;
+	var buffer = this._chunks.length > 1 ? Buffer.concat(this._chunks, this._buffered) : this._chunks[0];
+	var pos = 0;
+	while(buffer.length - pos >= 4) {
+		var length = buffer.readUInt32LE(pos);
+		if(buffer.length - pos - 4 < length) break;
+		this._onFrame(buffer.subarray(pos + 4, pos + 4 + length));
+		pos += 4 + length;
+	}
+	this._chunks = pos < buffer.length ? [ buffer.subarray(pos) ] : [];
+	this._buffered = buffer.length - pos;
+};
+
+DaemonClient.prototype._onFrame = function(frame) {
+	var requestId = frame.readUInt32LE(0);
+	var callback = this._callbacks[requestId];
+	if(!callback) return;
+	delete this._callbacks[requestId];
+	if(frame.readUInt16LE(4) !== RESPONSE_OK) {
+		callback(new Error(frame.toString('utf8', 12)));
+		return;
+	}
+	var count = frame.readUInt32LE(8);
+	var results = new Array(count);
+	for(var i = 0; i < count; i++) {
+		results[i] = decodeResults(frame, 12 + i * RESULT_RECORD_SIZE);
+	}
+	callback(null, results);
+};
+
+DaemonClient.prototype._fail = function(error) {
+	if(this._closed) return;
+	this._closed = true;
+	var callbacks = this._callbacks;
+	this._callbacks = {};
+	Object.keys(callbacks).forEach(function(requestId) {
+		callbacks[requestId](error);
+	});
+	if(error.message !== 'Daemon connection closed' && this.listenerCount('error')) this.emit('error', error);
+};
+
+// A results object like runSimulation() returns, with the same fields in the same order
+function decodeResults(frame, pos) {
+	var flags = frame[pos + 41];
+	var rejectReason = frame[pos + 42];
+	var results = {
+		efficiency: frame.readFloatLE(pos),
+		totalEUPerCycle: frame.readFloatLE(pos + 4),
+		euPerTick: frame.readInt32LE(pos + 8),
+		overallEUPerTick: frame.readInt32LE(pos + 12),
+		usesSingleUseCoolant: !!(flags & FLAG_USES_SINGLE_USE_COOLANT),
+		timedOut: !!(flags & FLAG_TIMED_OUT),
+		cooldownTicks: frame.readInt32LE(pos + 16),
+		cycleTicks: frame.readInt32LE(pos + 20),
+		mark: frame.readInt8(pos + 40),
+		numIterationsBeforeFailure: frame.readInt32LE(pos + 24),
+		ticksUntilMeltdown: frame.readInt32LE(pos + 28),
+		ticksUntilComponentFailure: frame.readInt32LE(pos + 32),
+		totalCost: frame.readInt32LE(pos + 36),
+		incomplete: !!(flags & FLAG_INCOMPLETE),
+		rejected: rejectReason !== 0
+	};
+	if(rejectReason) results.rejectReason = rejectReasonNames[rejectReason];
+	return results;
+}
+
+// Connects to the daemon listening on path (default /tmp/reactorsimd.sock).  callback(error, client).
+function connectDaemon(codes, path, callback) {
+	if(typeof path === 'function') {
+		callback = path;
+		path = undefined;
+	}
+	var socket = net.connect(path || DEFAULT_SOCKET_PATH);
+	function onError(error) {
+		callback(error);
+	}
+	socket.once('error', onError);
+	socket.once('connect', function() {
+		socket.removeListener('error', onError);
+		callback(null, new DaemonClient(socket, codes));
+	});
+}
+
+exports.DaemonClient = DaemonClient;
+exports.connectDaemon = connectDaemon;
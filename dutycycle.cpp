@@ -0,0 +1,243 @@
+#include "dutycycle.hpp"
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+namespace reactorsim {
+
+namespace {
+
+// The continuous run from cold after `ticks` ticks, where every schedule with that many on ticks
+// starts its first off phase
+struct PrefixPoint {
+	int ticks;
+	int eu;
+	ReactorSnapshot snapshot;
+};
+
+// The state at the start of an off phase
+struct Boundary {
+	ReactorSnapshot state;
+	int fuelPosition;	// on ticks into the current fuel cycle, if it affects the future
+	int64_t ticks;
+	int64_t eu;
+};
+
+enum ScheduleOutcome {
+	SCHEDULE_SAFE,
+	SCHEDULE_FAILED,
+	SCHEDULE_UNPROVEN,	// ran out of maxScheduleTicks
+	SCHEDULE_CANCELLED
+};
+
+bool isFuel(ComponentType type) {
+	return type == URANIUM_CELL || type == DUAL_URANIUM_CELL || type == QUAD_URANIUM_CELL;
+}
+
+bool isReflector(ComponentType type) {
+	return type == NEUTRON_REFLECTOR || type == THICK_NEUTRON_REFLECTOR;
+}
+
+class SchedulePlanner {
+public:
+	SchedulePlanner(Reactor& base, const DutyCycleOptions& options, DutyCycleResults& results) : base(base), options(options), results(results), hasCondensators(false) {
+		for(auto& component : base.components) {
+			if(component.get() && (component->type == CONDENSATOR_RSH || component->type == CONDENSATOR_LZH)) hasCondensators = true;
+		}
+	}
+
+	std::vector<PrefixPoint> prefix;
+
+	// Runs the reactor continuously from cold, recording its state every granularity ticks until a
+	// component fails, it melts down or the fuel is used.  Returns false if cancelled.
+	bool recordPrefix() {
+		Reactor reactor(base);
+		for(int ticks = options.granularity; ; ticks += options.granularity) {
+			if(ticks > Reactor::fuelTicks) ticks = Reactor::fuelTicks;
+			RunUntilStopReason reason = reactor.runUntil(true, false, false, true, ticks);
+			results.ticksSimulated = reactor.pendingSimState.curTick;
+			if(reason == STOPPED_ON_CANCELLED) return false;
+			if(reason != STOPPED_ON_MAX_TICKS) return true;
+			reactor.commit();
+			PrefixPoint point = { ticks, reactor.curSimState.euGenerated, reactor.captureSnapshot() };
+			prefix.push_back(point);
+			if(ticks == Reactor::fuelTicks) return true;
+		}
+	}
+
+	// Reflectors wear by a fixed amount per tick on, so whether they last a fuel cycle does not depend
+	// on the schedule
+	bool reflectorsWearOut() {
+		const PrefixPoint& last = prefix.back();
+		for(unsigned int i = 0; i < base.components.size(); ++i) {
+			ReactorComponent* comp = base.components[i].get();
+			if(comp && isReflector(comp->type) && (int64_t)last.snapshot.cellUsage[i] * Reactor::fuelTicks > (int64_t)comp->getDurability() * last.ticks) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Runs the schedule that starts at the prefix point until the state at the start of an off phase
+	// repeats.  Sets overallEUPerTick to the average over the repeating part if it does.
+	ScheduleOutcome testSchedule(const PrefixPoint& start, int offTicks, float& overallEUPerTick) {
+		results.schedulesTested++;
+		Reactor reactor(base);
+		reactor.restoreSnapshot(start.snapshot);
+		int onTicks = start.ticks;
+		int fuelPosition = start.ticks;
+		int64_t ticks = start.ticks;
+		int64_t eu = start.eu;
+		std::unordered_multimap<size_t, Boundary> seen;
+
+		for(;;) {
+			if(fuelPosition == Reactor::fuelTicks) {
+				reactor.resetUsage();
+				fuelPosition = 0;
+			}
+			Boundary boundary = { getState(reactor), hasCondensators ? fuelPosition : 0, ticks, eu };
+			size_t hash = boundary.state.hash() ^ (size_t)boundary.fuelPosition;
+			auto range = seen.equal_range(hash);
+			for(auto itr = range.first; itr != range.second; ++itr) {
+				if(itr->second.fuelPosition == boundary.fuelPosition && itr->second.state == boundary.state) {
+					overallEUPerTick = (float)(eu - itr->second.eu) / (float)(ticks - itr->second.ticks);
+					return SCHEDULE_SAFE;
+				}
+			}
+			seen.insert(std::make_pair(hash, boundary));
+			if(ticks - start.ticks >= options.maxScheduleTicks) return SCHEDULE_UNPROVEN;
+
+			reactor.producing = false;
+			ScheduleOutcome outcome = runPhase(reactor, offTicks, ticks, eu);
+			if(outcome != SCHEDULE_SAFE) return outcome;
+			reactor.producing = true;
+			for(int remaining = onTicks; remaining > 0; ) {
+				if(fuelPosition == Reactor::fuelTicks) {
+					reactor.resetUsage();
+					fuelPosition = 0;
+				}
+				int chunk = std::min(remaining, Reactor::fuelTicks - fuelPosition);
+				outcome = runPhase(reactor, chunk, ticks, eu);
+				if(outcome != SCHEDULE_SAFE) return outcome;
+				fuelPosition += chunk;
+				remaining -= chunk;
+			}
+		}
+	}
+
+private:
+	Reactor& base;	// initialized and cold
+	const DutyCycleOptions& options;
+	DutyCycleResults& results;
+	bool hasCondensators;
+
+	// Fuel and reflector usage only matter when the fuel is replaced, so unless condensators make the
+	// point in the fuel cycle matter, states that differ only in them are equivalent
+	ReactorSnapshot getState(Reactor& reactor) {
+		ReactorSnapshot state = reactor.captureSnapshot();
+		for(unsigned int i = 0; i < reactor.components.size(); ++i) {
+			ReactorComponent* comp = reactor.components[i].get();
+			if(comp && (isFuel(comp->type) || isReflector(comp->type))) state.cellUsage[i] = 0;
+		}
+		return state;
+	}
+
+	// Runs and commits the given number of ticks, adding them and the EU generated to the totals.
+	// Returns SCHEDULE_SAFE if nothing failed.
+	ScheduleOutcome runPhase(Reactor& reactor, int phaseTicks, int64_t& ticks, int64_t& eu) {
+		if(phaseTicks == 0) return SCHEDULE_SAFE;
+		int startTick = reactor.curSimState.curTick;
+		int startEU = reactor.curSimState.euGenerated;
+		RunUntilStopReason reason = reactor.runUntil(true, false, false, true, startTick + phaseTicks);
+		results.ticksSimulated += reactor.pendingSimState.curTick - startTick;
+		if(reason == STOPPED_ON_CANCELLED) return SCHEDULE_CANCELLED;
+		if(reason != STOPPED_ON_MAX_TICKS) return SCHEDULE_FAILED;
+		reactor.commit();
+		ticks += phaseTicks;
+		eu += reactor.curSimState.euGenerated - startEU;
+		return SCHEDULE_SAFE;
+	}
+};
+
+}
+
+DutyCycleResults planDutyCycle(Reactor& reactor, const DutyCycleOptions& options) {
+	DutyCycleResults results;
+	Reactor base(reactor);
+	base.initializeSimulation();
+	if(!base.numUraniumCells || options.granularity <= 0) return results;
+
+	SchedulePlanner planner(base, options, results);
+	if(!planner.recordPrefix()) {
+		results.incomplete = true;
+		return results;
+	}
+	if(planner.prefix.empty() || planner.reflectorsWearOut()) return results;
+	const PrefixPoint& last = planner.prefix.back();
+	results.euPerTick = last.eu / last.ticks;
+
+	// Continuous operation, the same as any schedule without off ticks
+	float overall;
+	if(last.ticks == Reactor::fuelTicks) {
+		ScheduleOutcome outcome = planner.testSchedule(last, 0, overall);
+		if(outcome == SCHEDULE_CANCELLED) {
+			results.incomplete = true;
+			return results;
+		}
+		if(outcome == SCHEDULE_SAFE) {
+			results.found = true;
+			results.onTicks = Reactor::fuelTicks;
+			results.offTicks = 0;
+			results.overallEUPerTick = overall;
+			return results;
+		}
+	}
+
+	// For each on phase, binary search for the shortest off phase that is safe.  All schedules with the
+	// same on phase start from the same prefix point.
+	int granularity = options.granularity;
+	for(const PrefixPoint& start : planner.prefix) {
+		if(start.ticks > options.maxOnTicks) break;
+		// Off phases this long or longer cannot beat the best schedule found so far
+		int maxOffTicks = options.maxOffTicks;
+		if(results.found) {
+			double breakEven = (double)start.eu / results.overallEUPerTick - start.ticks;
+			if(breakEven < maxOffTicks) maxOffTicks = (int)std::ceil(breakEven) - 1;
+		}
+		maxOffTicks = maxOffTicks / granularity * granularity;
+		if(maxOffTicks < granularity) continue;
+
+		ScheduleOutcome outcome = planner.testSchedule(start, maxOffTicks, overall);
+		if(outcome == SCHEDULE_CANCELLED) {
+			results.incomplete = true;
+			return results;
+		}
+		if(outcome != SCHEDULE_SAFE) continue;
+		int safeOffTicks = maxOffTicks;
+		float safeOverall = overall;
+		int unsafeOffTicks = 0;	// without off ticks it is continuous operation, which is not safe
+		while(safeOffTicks - unsafeOffTicks > granularity) {
+			int offTicks = (unsafeOffTicks + safeOffTicks) / 2 / granularity * granularity;
+			outcome = planner.testSchedule(start, offTicks, overall);
+			if(outcome == SCHEDULE_CANCELLED) {
+				results.incomplete = true;
+				return results;
+			}
+			if(outcome == SCHEDULE_SAFE) {
+				safeOffTicks = offTicks;
+				safeOverall = overall;
+			} else {
+				unsafeOffTicks = offTicks;
+			}
+		}
+		if(!results.found || safeOverall > results.overallEUPerTick) {
+			results.found = true;
+			results.onTicks = start.ticks;
+			results.offTicks = safeOffTicks;
+			results.overallEUPerTick = safeOverall;
+		}
+	}
+	return results;
+}
+
+}
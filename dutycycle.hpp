@@ -0,0 +1,35 @@
+#ifndef DUTYCYCLE_HPP
+#define DUTYCYCLE_HPP
+
+#include "reactorsim.hpp"
+
+namespace reactorsim {
+
+// Pulsed operation: the reactor is switched on for onTicks and off for offTicks, over and over, with
+// the fuel (and condensators and reflectors) replaced each time it has been on for a full fuel cycle
+struct DutyCycleOptions {
+	int granularity = 20;		// onTicks and offTicks are multiples of this
+	int maxOnTicks = 2000;		// longest on phase tried, apart from continuous operation
+	int maxOffTicks = 10000;	// longest off phase tried
+	int maxScheduleTicks = 200000;	// ticks simulated per schedule before giving up on proving it safe
+};
+
+struct DutyCycleResults {
+	bool found = false;			// whether any schedule was proven safe
+	int onTicks = 0;			// Reactor::fuelTicks with offTicks 0 for continuous operation
+	int offTicks = 0;
+	int euPerTick = 0;			// EU/t while on
+	float overallEUPerTick = 0;	// average EU/t over the repeating part of the schedule
+	int schedulesTested = 0;
+	int64_t ticksSimulated = 0;
+	bool incomplete = false;	// stopped by the reactor's cancellation token
+};
+
+// Finds the schedule with the highest overallEUPerTick under which the reactor provably runs
+// forever without a component failing or melting down.  A schedule is proven safe once the state at
+// the start of an off phase repeats.  Assumes that a longer off phase is never less safe.
+DutyCycleResults planDutyCycle(Reactor& reactor, const DutyCycleOptions& options = DutyCycleOptions());
+
+}
+
+#endif
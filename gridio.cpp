@@ -4,66 +4,72 @@
 #include <string>
 #include <stdlib.h>
 #include <iomanip>
+#include <cstring>
+#ifdef _WIN32
+#include <sstream>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace reactorsim {
 
 
-std::map<std::string, ComponentType> componentTypeByAbbr;
-std::map<ComponentType, std::string> abbrByComponentType;
+// Indexed by ComponentType.  Constant so lookups are safe from any thread.
+static const char* const componentAbbrs[COMPONENT_COUNT] = {
+	"XX",
+	"VV", "VR", "VA", "VC", "VO",
+	"EE", "EA", "ER", "EC",
+	"C1", "C3", "C6",
+	"CR", "CL",
+	"U1", "U2", "U4",
+	"NN", "NT",
+	"PP", "PC", "PH"
+};
 
-void addComponentString(ComponentType type, std::string abbr) {
-	componentTypeByAbbr[std::string(abbr)] = type;
-	abbrByComponentType[type] = std::string(abbr);
-}
+// ComponentType by the two characters of its abbreviation, -1 where there is none.  Filled in
+// during static initialization and only read afterwards.
+struct AbbrTable {
+	signed char types[128][128];
+	AbbrTable() {
+		memset(types, -1, sizeof(types));
+		for(int i = 0; i < COMPONENT_COUNT; ++i) {
+			types[(int)componentAbbrs[i][0]][(int)componentAbbrs[i][1]] = i;
+		}
+	}
+	int lookup(unsigned char a, unsigned char b) const {
+		if(a >= 128 || b >= 128) return -1;
+		return types[a][b];
+	}
+};
+static const AbbrTable abbrTable;
 
-void loadStringMaps() {
-	if(componentTypeByAbbr.size()) return;
-	addComponentString(COMPONENT_NONE, "XX");
-	addComponentString(HEAT_VENT, "VV");
-	addComponentString(REACTOR_HEAT_VENT, "VR");
-	addComponentString(ADVANCED_HEAT_VENT, "VA");
-	addComponentString(COMPONENT_HEAT_VENT, "VC");
-	addComponentString(OVERCLOCKED_HEAT_VENT, "VO");
-	addComponentString(HEAT_EXCHANGER, "EE");
-	addComponentString(ADVANCED_HEAT_EXCHANGER, "EA");
-	addComponentString(CORE_HEAT_EXCHANGER, "ER");
-	addComponentString(COMPONENT_HEAT_EXCHANGER, "EC");
-	addComponentString(COOLANT_CELL_10, "C1");
-	addComponentString(COOLANT_CELL_30, "C3");
-	addComponentString(COOLANT_CELL_60, "C6");
-	addComponentString(CONDENSATOR_RSH, "CR");
-	addComponentString(CONDENSATOR_LZH, "CL");
-	addComponentString(URANIUM_CELL, "U1");
-	addComponentString(DUAL_URANIUM_CELL, "U2");
-	addComponentString(QUAD_URANIUM_CELL, "U4");
-	addComponentString(NEUTRON_REFLECTOR, "NN");
-	addComponentString(THICK_NEUTRON_REFLECTOR, "NT");
-	addComponentString(REACTOR_PLATING, "PP");
-	addComponentString(CONTAINMENT_REACTOR_PLATING, "PC");
-	addComponentString(HEAT_CAPACITY_REACTOR_PLATING, "PH");
+// Returns the index of the abbreviation in componentAbbrs, or -1
+static int findComponentAbbr(const std::string& str) {
+	if(str.length() != 2) return -1;
+	return abbrTable.lookup(str[0], str[1]);
 }
 
 std::string getComponentTypeAbbr(ComponentType type) {
-	loadStringMaps();
-	if(abbrByComponentType.find(type) == abbrByComponentType.end()) {
+	if(type < 0 || type >= COMPONENT_COUNT) {
 		return std::to_string((int)type);
 	} else {
-		return abbrByComponentType[type];
+		return componentAbbrs[type];
 	}
 }
 
-ComponentType getComponentTypeByAbbr(std::string& str) {
-	loadStringMaps();
-	return componentTypeByAbbr[str];
+ComponentType getComponentTypeByAbbr(const std::string& str) {
+	int i = findComponentAbbr(str);
+	return i == -1 ? COMPONENT_NONE : (ComponentType)i;
 }
 
-bool isValidComponentTypeAbbr(std::string& str) {
-	loadStringMaps();
-	return componentTypeByAbbr.find(str) != componentTypeByAbbr.end();
+bool isValidComponentTypeAbbr(const std::string& str) {
+	return findComponentAbbr(str) != -1;
 }
 
 void loadTypesGrid(const std::string& filename, std::vector<ComponentType>&components, int& width, int& height) {
-	loadStringMaps();
 	std::ifstream ifs;
 	ifs.open(filename, std::ifstream::in);
 	width = 0;
@@ -94,8 +100,138 @@ void loadTypesGrid(const std::string& filename, std::vector<ComponentType>&compo
 	}
 }
 
+/***** Multi-grid files *****/
+
+static const int gridHeight = 6;
+
+static bool isGridSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// State of the grid being parsed
+struct GridParser {
+	PackedLayouts& layouts;
+	std::vector<GridParseError>& errors;
+	size_t maxErrors;
+	size_t numErrors = 0;
+	bool inGrid = false;
+	bool bad = false;
+	uint32_t firstLine = 0;
+	int rows = 0;
+	int width = 0;
+	size_t start = 0;	// of the grid in layouts.types
+
+	GridParser(PackedLayouts& layouts, std::vector<GridParseError>& errors, size_t maxErrors) : layouts(layouts), errors(errors), maxErrors(maxErrors) {}
+
+	void error(uint32_t line, uint32_t column, const std::string& message) {
+		bad = true;
+		if(numErrors++ < maxErrors) {
+			GridParseError err = { line, column, message };
+			errors.push_back(err);
+		}
+	}
+
+	void begin(uint32_t line) {
+		inGrid = true;
+		bad = false;
+		firstLine = line;
+		rows = 0;
+		width = 0;
+		start = layouts.types.size();
+	}
+
+	void end() {
+		inGrid = false;
+		if(!bad && rows != gridHeight) {
+			error(firstLine, 0, "Grid has " + std::to_string(rows) + " rows, expected " + std::to_string(gridHeight));
+		} else if(!bad && (width < 3 || width > 9)) {
+			error(firstLine, 0, "Grid has " + std::to_string(width) + " columns, expected 3 to 9");
+		}
+		if(bad) {
+			layouts.types.resize(start);
+		} else {
+			layouts.widths.push_back((unsigned char)width);
+			layouts.lines.push_back(firstLine);
+		}
+	}
+
+	void parseLine(const char* p, const char* lineEnd, uint32_t line) {
+		const char* lineStart = p;
+		int count = 0;
+		for(;;) {
+			while(p < lineEnd && isGridSpace(*p)) ++p;
+			if(p == lineEnd) break;
+			const char* token = p;
+			while(p < lineEnd && !isGridSpace(*p)) ++p;
+			if(!inGrid) begin(line);
+			int type = p - token == 2 ? abbrTable.lookup(token[0], token[1]) : -1;
+			if(type == -1) {
+				error(line, token - lineStart + 1, "Invalid component code '" + std::string(token, p - token) + "'");
+			} else if(!bad) {
+				layouts.types.push_back((unsigned char)type);
+			}
+			count++;
+		}
+		if(count == 0) {
+			if(inGrid) end();
+			return;
+		}
+		if(rows == 0) {
+			width = count;
+		} else if(count != width && !bad) {
+			error(line, 0, "Row has " + std::to_string(count) + " codes, expected " + std::to_string(width));
+		}
+		rows++;
+	}
+};
+
+size_t parseGrids(const char* data, size_t length, PackedLayouts& layouts, std::vector<GridParseError>& errors, size_t maxErrors) {
+	GridParser parser(layouts, errors, maxErrors);
+	const char* end = data + length;
+	uint32_t line = 1;
+	for(const char* p = data; p < end; ++line) {
+		const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+		if(!lineEnd) lineEnd = end;
+		parser.parseLine(p, lineEnd, line);
+		p = lineEnd + 1;
+	}
+	if(parser.inGrid) parser.end();
+	return parser.numErrors;
+}
+
+bool loadGridFile(const std::string& filename, PackedLayouts& layouts, std::vector<GridParseError>& errors, size_t& numErrors, size_t maxErrors) {
+	numErrors = 0;
+#ifdef _WIN32
+	std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+	if(!ifs.good()) return false;
+	std::stringstream contents;
+	contents << ifs.rdbuf();
+	std::string data = contents.str();
+	numErrors = parseGrids(data.data(), data.size(), layouts, errors, maxErrors);
+	return true;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd == -1) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return true;
+	}
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) return false;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	numErrors = parseGrids(static_cast<const char*>(data), st.st_size, layouts, errors, maxErrors);
+	munmap(data, st.st_size);
+	return true;
+#endif
+}
+
 void printTypesGrid(std::vector<ComponentType>& types, int width, int height) {
-	loadStringMaps();
 	int n = 0;
 	for(std::vector<ComponentType>::iterator itr = types.begin(); itr != types.end(); ++itr) {
 		if(n % width != 0) std::cout << ' ';
@@ -106,7 +242,6 @@ void printTypesGrid(std::vector<ComponentType>& types, int width, int height) {
 }
 
 void printReactor(Reactor& reactor) {
-	loadStringMaps();
 	int n = 0;
 	for(auto& component : reactor.components) {
 		if(n % reactor.width != 0) std::cout << ' ';
@@ -3,22 +3,40 @@
 
 #include <iostream>
 #include <vector>
-#include <map>
 #include <string>
 #include <memory>
+#include <cstdint>
 #include "reactorsim.hpp"
 
 namespace reactorsim {
 
-extern std::map<std::string, ComponentType> componentTypeByAbbr;
-extern std::map<ComponentType, std::string> abbrByComponentType;
-
 std::string getComponentTypeAbbr(ComponentType type);
-ComponentType getComponentTypeByAbbr(std::string& str);
-bool isValidComponentTypeAbbr(std::string& str);
+ComponentType getComponentTypeByAbbr(const std::string& str);	// COMPONENT_NONE if invalid
+bool isValidComponentTypeAbbr(const std::string& str);
 
 
 void loadTypesGrid(const std::string& filename, std::vector<ComponentType>&components, int& width, int& height);
+
+// Layouts read from a multi-grid file, stored back to back
+struct PackedLayouts {
+	std::vector<unsigned char> types;	// ComponentType of every cell, row-major, layout after layout
+	std::vector<unsigned char> widths;	// width of each layout; all are 6 high
+	std::vector<uint32_t> lines;	// line of each layout's first row
+	size_t size() const { return widths.size(); }
+};
+
+struct GridParseError {
+	uint32_t line;
+	uint32_t column;	// 1-based; 0 if the error is about the whole grid
+	std::string message;
+};
+
+// Parses grids separated by blank lines.  Invalid grids are skipped; the first maxErrors errors are
+// recorded.  Returns the number of errors found.
+size_t parseGrids(const char* data, size_t length, PackedLayouts& layouts, std::vector<GridParseError>& errors, size_t maxErrors = 1000);
+// Memory-maps the file and parses it with parseGrids(), setting numErrors to its result.  Returns
+// false if the file cannot be read.
+bool loadGridFile(const std::string& filename, PackedLayouts& layouts, std::vector<GridParseError>& errors, size_t& numErrors, size_t maxErrors = 1000);
 void printTypesGrid(std::vector<ComponentType>& types, int width, int height);
 void printReactor(Reactor& reactor);
 
@@ -1,7 +1,133 @@
 //var reactorsim = require('./build/Release/nodereactorsim.node');
 var reactorsim = require('bindings')('nodereactorsim.node');
 
+var fs = require('fs');
+var simstream = require('./simstream');
+var sweep = require('./sweep');
+var resultsfile = require('./resultsfile');
+var daemonclient = require('./daemonclient');
+var simresults = require('./simresults');
+
+// Results objects are built in JS from the addon's buffers; see simresults.js
+reactorsim.setResultsFactory(simresults.createResults);
+
 exports.runSimulation = reactorsim.runSimulation;
+exports.runSimulationSync = reactorsim.runSimulationSync;
+exports.runSimulationBatch = function(layouts, options, callback) {
+	return callBatch(reactorsim.runSimulationBatch, arguments, 3);
+};
+exports.runSimulationStates = function(layout, states, options, callback) {
+	return callBatch(reactorsim.runSimulationStates, arguments, 4);
+};
+
+// With results: 'columns', the addon calls back with the Float64Array of results slots, which is
+// wrapped in its accessors; see simresults.js.  numArgs counts the optional options.
+function callBatch(run, args, numArgs) {
+	args = Array.prototype.slice.call(args);
+	var options = args.length === numArgs ? args[numArgs - 2] : null;
+	var callback = args[args.length - 1];
+	if(options && options.results === 'columns' && typeof callback === 'function') {
+		args[args.length - 1] = function(error, values) {
+			callback(error, values && new simresults.ResultColumns(values));
+		};
+	}
+	return run.apply(reactorsim, args);
+}
+exports.planDutyCycle = reactorsim.planDutyCycle;
+exports.loadGridFile = reactorsim.loadGridFile;
+exports.traceCompiledIn = reactorsim.traceCompiledIn;
+exports.usdtCompiledIn = reactorsim.usdtCompiledIn;
+exports.canonicalizeLayout = reactorsim.canonicalizeLayout;
+exports.configureLanes = reactorsim.configureLanes;
+exports.configureDelivery = reactorsim.configureDelivery;
+exports.getStats = reactorsim.getStats;
+exports.resetStats = reactorsim.resetStats;
+
+// Returns a Duplex stream that simulates the layouts written to it; see simstream.js for options
+exports.createSimulationStream = function(options) {
+	return new simstream.SimulationStream(reactorsim, options);
+};
+
+// Simulates every layout of an iterable or async iterable.  Returns a stream of results that can be
+// consumed with for await...of.
+exports.simulateAll = function(layouts, options) {
+	return simstream.simulateAll(reactorsim, layouts, options);
+};
+
+// A layout space of every assignment of codes to cells; see sweep.js
+exports.productSpace = sweep.productSpace;
+
+// Returns a resumable, shardable sweep over a layout space; see sweep.js for options
+exports.createSweep = function(options) {
+	return new sweep.Sweep(reactorsim, options);
+};
+
+exports.tracePhases = [ 'firstRun', 'cooldown', 'runUntilFinish', 'rerun' ];
+exports.traceEventKinds = [ 'componentDestroyed', 'meltdown' ];
+
+// Reads a trace written with the { trace: { file: ... } } option into the same typed array
+// layout that in-memory traces are returned in.
+exports.readTraceFile = function(filename) {
+	var buf = fs.readFileSync(filename);
+	var words = new Int32Array(buf.buffer, buf.byteOffset, Math.floor(buf.length / 4));
+	if(words[0] !== 0x52545352) throw new Error('Not a reactor trace file');
+	var numCells = words[2] * words[3];
+	var frames = [], events = [];
+	for(var pos = 5; pos < words.length; ) {
+		if(words[pos] === 0) {
+			frames.push(pos);
+			pos += 5 + numCells;
+		} else {
+			events.push(pos);
+			pos += 5;
+		}
+	}
+	var trace = {
+		interval: words[4],
+		numCells: numCells,
+		droppedFrames: 0,
+		tick: new Int32Array(frames.length),
+		phase: new Uint8Array(frames.length),
+		reactorHeat: new Int32Array(frames.length),
+		euGenerated: new Int32Array(frames.length),
+		cellHeat: new Int32Array(frames.length * numCells),
+		eventTick: new Int32Array(events.length),
+		eventCell: new Int32Array(events.length),
+		eventPhase: new Uint8Array(events.length),
+		eventKind: new Uint8Array(events.length)
+	};
+	frames.forEach(function(p, i) {
+		trace.tick[i] = words[p + 1];
+		trace.phase[i] = words[p + 2];
+		trace.reactorHeat[i] = words[p + 3];
+		trace.euGenerated[i] = words[p + 4];
+		trace.cellHeat.set(words.subarray(p + 5, p + 5 + numCells), i * numCells);
+	});
+	events.forEach(function(p, i) {
+		trace.eventTick[i] = words[p + 1];
+		trace.eventPhase[i] = words[p + 2];
+		trace.eventCell[i] = words[p + 3];
+		trace.eventKind[i] = words[p + 4];
+	});
+	return trace;
+};
+
+// Memory-maps a results file written with the resultsFile option of runSimulationBatch; see
+// resultsfile.js
+exports.readResultsFile = function(filename) {
+	return resultsfile.readResultsFile(reactorsim, exports.allComponents, filename);
+};
+exports.resultsFileColumns = resultsfile.columns;
+// Rewrites a results file into a single block, so that readResultsFile() columns are views on it.
+// callback(error).
+exports.compactResultsFile = reactorsim.compactResultsFile;
+
+// Connects to a reactorsimd simulation daemon; see daemonclient.js.  path defaults to
+// /tmp/reactorsimd.sock.  callback(error, client), where client.simulate(layouts, options, callback)
+// simulates an array of layouts.
+exports.connectDaemon = function(path, callback) {
+	return daemonclient.connectDaemon(exports.allComponents, path, callback);
+};
 
 exports.getDimensions = function(numExtraChambers) {
 	return {
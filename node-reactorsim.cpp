@@ -1,23 +1,154 @@
-#include <node.h>
-#include <v8.h>
+#include <node_api.h>
+#include <uv.h>
 #include <vector>
 #include <iostream>
 #include <string>
 #include <memory>
-#include <uv.h>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <deque>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <sstream>
+#endif
 #include "reactorsim.hpp"
 #include "gridio.hpp"
+#include "simtrace.hpp"
+#include "simstats.hpp"
+#include "simprobes.hpp"
+#include "dutycycle.hpp"
+#include "simcost.hpp"
+#include "symmetry.hpp"
+#include "resultsfile.hpp"
 
-using namespace v8;
 using namespace reactorsim;
 using std::vector;
 
-Local<Object> simResultsToV8Object(SimulationResults& results) {
-	Local<Object> obj = Object::New();
+// The addon is context-aware: everything mutable lives in per-environment AddonData or in the
+// objects of a single call, so it can be loaded in any number of worker threads.  Each thread
+// queues work on its own event loop; the component tables and stats are thread-safe.
+
+
+/***** Value helpers *****/
+
+napi_value newNumber(napi_env env, double value) {
+	napi_value result;
+	napi_create_double(env, value, &result);
+	return result;
+}
+
+napi_value newInt(napi_env env, int32_t value) {
+	napi_value result;
+	napi_create_int32(env, value, &result);
+	return result;
+}
+
+napi_value newBool(napi_env env, bool value) {
+	napi_value result;
+	napi_get_boolean(env, value, &result);
+	return result;
+}
+
+napi_value newString(napi_env env, const char* value) {
+	napi_value result;
+	napi_create_string_utf8(env, value, NAPI_AUTO_LENGTH, &result);
+	return result;
+}
+
+napi_value newObject(napi_env env) {
+	napi_value result;
+	napi_create_object(env, &result);
+	return result;
+}
+
+napi_value getUndefined(napi_env env) {
+	napi_value result;
+	napi_get_undefined(env, &result);
+	return result;
+}
+
+void setNamed(napi_env env, napi_value obj, const char* name, napi_value value) {
+	napi_set_named_property(env, obj, name, value);
+}
+
+// Returns the named property, or null if obj is null or does not have it
+napi_value getOption(napi_env env, napi_value obj, const char* name) {
+	bool has = false;
+	if(!obj || napi_has_named_property(env, obj, name, &has) != napi_ok || !has) return nullptr;
+	napi_value value;
+	napi_get_named_property(env, obj, name, &value);
+	return value;
+}
+
+bool toBool(napi_env env, napi_value value) {
+	napi_value coerced;
+	bool result = false;
+	napi_coerce_to_bool(env, value, &coerced);
+	napi_get_value_bool(env, coerced, &result);
+	return result;
+}
+
+int64_t toInt64(napi_env env, napi_value value) {
+	napi_value coerced;
+	int64_t result = 0;
+	napi_coerce_to_number(env, value, &coerced);
+	napi_get_value_int64(env, coerced, &result);
+	return result;
+}
 
-#define RES_NUMBER(name) obj->Set(String::New(#name), Number::New(results.name));
-#define RES_INT(name) obj->Set(String::New(#name), Integer::New(results.name));
-#define RES_BOOL(name) obj->Set(String::New(#name), Boolean::New(results.name));
+std::string toUtf8(napi_env env, napi_value value) {
+	napi_value coerced;
+	size_t len = 0;
+	napi_coerce_to_string(env, value, &coerced);
+	napi_get_value_string_utf8(env, coerced, nullptr, 0, &len);
+	std::string result(len, '\0');
+	napi_get_value_string_utf8(env, coerced, &result[0], len + 1, &len);
+	return result;
+}
+
+// Rethrows an exception left by a JS callback as an uncaught exception, so that it does not
+// break the N-API calls that follow
+void reportCallbackException(napi_env env) {
+	bool pending = false;
+	napi_is_exception_pending(env, &pending);
+	if(pending) {
+		napi_value error;
+		napi_get_and_clear_last_exception(env, &error);
+		napi_fatal_exception(env, error);
+	}
+}
+
+// Creates a typed array of the given type and element size and returns its backing store in data
+napi_value newTypedArray(napi_env env, napi_typedarray_type type, size_t elementSize, size_t length, void** data) {
+	napi_value buffer, arr;
+	napi_create_arraybuffer(env, length * elementSize, data, &buffer);
+	napi_create_typedarray(env, type, length, buffer, 0, &arr);
+	return arr;
+}
+
+
+/***** Results *****/
+
+static const char* stopReasonNames[] = { "meltdown", "fuelUsed", "cooledDown", "componentFailed", "maxTicks", "cancelled" };
+static const char* cancelReasonNames[] = { "none", "cancelled", "tickBudget", "deadline" };
+static const char* rejectReasonNames[] = { "none", "euPerTick", "overallEUPerTick", "mark" };
+
+#define RES_NUMBER(name) setNamed(env, obj, #name, newNumber(env, results.name));
+#define RES_INT(name) setNamed(env, obj, #name, newInt(env, results.name));
+#define RES_BOOL(name) setNamed(env, obj, #name, newBool(env, results.name));
+
+napi_value simResultsToObject(napi_env env, SimulationResults& results) {
+	napi_value obj = newObject(env);
 
 	RES_NUMBER(efficiency)
 	RES_NUMBER(totalEUPerCycle)
@@ -32,66 +163,815 @@ Local<Object> simResultsToV8Object(SimulationResults& results) {
 	RES_INT(ticksUntilMeltdown)
 	RES_INT(ticksUntilComponentFailure)
 	RES_INT(totalCost)
+	RES_BOOL(incomplete)
+	setNamed(env, obj, "rejected", newBool(env, results.rejected != REJECT_NONE));
+	if(results.rejected != REJECT_NONE) {
+		setNamed(env, obj, "rejectReason", newString(env, rejectReasonNames[results.rejected]));
+	}
 
 	return obj;
 }
 
-struct SimData {
-	uv_work_t request;
-	Persistent<Function> callback;
+// Only the fields known after the first run
+napi_value firstRunResultsToObject(napi_env env, SimulationResults& results, RunUntilStopReason stopReason) {
+	napi_value obj = newObject(env);
+
+	RES_NUMBER(efficiency)
+	RES_NUMBER(totalEUPerCycle)
+	RES_INT(euPerTick)
+	RES_BOOL(usesSingleUseCoolant)
+	RES_INT(totalCost)
+	setNamed(env, obj, "stopReason", newString(env, stopReasonNames[stopReason]));
+
+	return obj;
+}
+
+static const char* stressFieldNames[] = { "peakHeat", "peakHeatRatio", "ticksAbove90", "wear" };
+
+napi_value stressToObject(napi_env env, StressReport& stress) {
+	napi_value obj = newObject(env);
+	napi_value fields;
+	napi_create_array_with_length(env, STRESS_FIELD_COUNT, &fields);
+	for(int i = 0; i < STRESS_FIELD_COUNT; ++i) {
+		napi_set_element(env, fields, i, newString(env, stressFieldNames[i]));
+	}
+	setNamed(env, obj, "fields", fields);
+	float* cells;
+	setNamed(env, obj, "cells", newTypedArray(env, napi_float32_array, 4, stress.cells.size(), (void**)&cells));
+	if(!stress.cells.empty()) memcpy(cells, &stress.cells[0], stress.cells.size() * sizeof(float));
+	setNamed(env, obj, "peakReactorHeat", newInt(env, stress.peakReactorHeat));
+	setNamed(env, obj, "peakReactorHeatRatio", newNumber(env, stress.peakReactorHeatRatio));
+	return obj;
+}
+
+napi_value traceToObject(napi_env env, RingTraceSink& trace) {
+	napi_value obj = newObject(env);
+	int32_t* ticks;
+	uint8_t* phases;
+	int32_t* reactorHeat;
+	int32_t* euGenerated;
+	int32_t* cellHeat;
+	uint32_t n = trace.numFrames;
+	uint32_t cells = trace.numCells;
+
+	setNamed(env, obj, "interval", newInt(env, trace.interval));
+	setNamed(env, obj, "numCells", newInt(env, trace.numCells));
+	setNamed(env, obj, "droppedFrames", newNumber(env, trace.totalFrames - trace.numFrames));
+	setNamed(env, obj, "tick", newTypedArray(env, napi_int32_array, 4, n, (void**)&ticks));
+	setNamed(env, obj, "phase", newTypedArray(env, napi_uint8_array, 1, n, (void**)&phases));
+	setNamed(env, obj, "reactorHeat", newTypedArray(env, napi_int32_array, 4, n, (void**)&reactorHeat));
+	setNamed(env, obj, "euGenerated", newTypedArray(env, napi_int32_array, 4, n, (void**)&euGenerated));
+	setNamed(env, obj, "cellHeat", newTypedArray(env, napi_int32_array, 4, n * cells, (void**)&cellHeat));
+	for(uint32_t i = 0; i < n; ++i) {
+		int s = trace.slot(i);
+		ticks[i] = trace.ticks[s];
+		phases[i] = trace.phases[s];
+		reactorHeat[i] = trace.reactorHeat[s];
+		euGenerated[i] = trace.euGenerated[s];
+		for(uint32_t c = 0; c < cells; ++c) cellHeat[i * cells + c] = trace.cellHeat[s * cells + c];
+	}
+
+	int32_t* eventTicks;
+	int32_t* eventCells;
+	uint8_t* eventPhases;
+	uint8_t* eventKinds;
+	uint32_t numEvents = trace.numEvents;
+	setNamed(env, obj, "droppedEvents", newNumber(env, trace.totalEvents - trace.numEvents));
+	setNamed(env, obj, "eventTick", newTypedArray(env, napi_int32_array, 4, numEvents, (void**)&eventTicks));
+	setNamed(env, obj, "eventCell", newTypedArray(env, napi_int32_array, 4, numEvents, (void**)&eventCells));
+	setNamed(env, obj, "eventPhase", newTypedArray(env, napi_uint8_array, 1, numEvents, (void**)&eventPhases));
+	setNamed(env, obj, "eventKind", newTypedArray(env, napi_uint8_array, 1, numEvents, (void**)&eventKinds));
+	for(uint32_t i = 0; i < numEvents; ++i) {
+		const TraceEvent& event = trace.event(i);
+		eventTicks[i] = event.tick;
+		eventCells[i] = event.cell;
+		eventPhases[i] = event.phase;
+		eventKinds[i] = event.kind;
+	}
+	return obj;
+}
+
+
+/***** Jobs *****/
+
+// Outstanding work that a handle returned to JS can cancel
+struct CancellableJob {
+	uint32_t jobId = 0;
+	virtual void cancel() = 0;
+	virtual ~CancellableJob() {}
+};
+
+struct SimData;
+
+// Simulations wait in a lane until they are handed to the thread pool.  Interactive ones are handed
+// over at once; bulk ones only while fewer than threads - reservedThreads of them are there, so the
+// pool's FIFO queue never holds more bulk work than it has threads, and an interactive simulation
+// starts as soon as a thread finishes its current job (or at once on a reserved thread).
+enum Lane {
+	LANE_INTERACTIVE,
+	LANE_BULK
+};
+
+static const char* laneNames[] = { "interactive", "bulk" };
+
+// Per-environment state.  Jobs are registered by id while outstanding, so cancelling through a
+// handle after completion does nothing.
+struct BatchData;
+
+struct AddonData {
+	std::unordered_map<uint32_t, CancellableJob*> outstandingJobs;
+	uint32_t nextJobId = 1;
+	// Queued or running simulations that can be shared, by coalescing key
+	std::unordered_map<std::string, SimData*> inFlight;
+
+	std::deque<SimData*> waiting[numLanes];
+	uint32_t dispatched[numLanes] = {};	// handed to the thread pool and not completed
+	uint32_t threads = 4;	// size of the thread pool, from UV_THREADPOOL_SIZE
+	uint32_t reservedThreads = 0;	// kept free of bulk simulations
+
+	// Completed simulations waiting to be delivered, in completion order.  The timer delivers them
+	// all at once, at most maxDeliveryLatency milliseconds after the first of them completed.
+	std::vector<SimData*> completed;
+	std::vector<BatchData*> emptyBatches;	// finished with the next delivery, never synchronously
+	uv_timer_t* deliveryTimer = nullptr;
+	napi_async_context deliveryContext = nullptr;
+	uint32_t maxDeliveryLatency = 0;
+
+	// Builds results objects from a ResultsArena (simresults.js), if registered
+	napi_ref resultsFactory = nullptr;
+
+	AddonData() {
+		const char* poolSize = getenv("UV_THREADPOOL_SIZE");
+		if(poolSize && atoi(poolSize) > 0) threads = std::min(atoi(poolSize), 1024);
+	}
+
+	uint32_t getBulkLimit() {
+		return threads > reservedThreads ? threads - reservedThreads : 1;
+	}
+};
+
+AddonData* getAddonData(napi_env env) {
+	AddonData* addonData = nullptr;
+	napi_get_instance_data(env, (void**)&addonData);
+	return addonData;
+}
+
+void deleteAddonData(napi_env env, void* data, void* hint) {
+	AddonData* addonData = static_cast<AddonData*>(data);
+	if(addonData->resultsFactory) napi_delete_reference(env, addonData->resultsFactory);
+	delete addonData;
+}
+
+napi_value nodeCancelJob(napi_env env, napi_callback_info info) {
+	void* data;
+	napi_get_cb_info(env, info, nullptr, nullptr, nullptr, &data);
+	AddonData* addonData = getAddonData(env);
+	std::unordered_map<uint32_t, CancellableJob*>::iterator itr = addonData->outstandingJobs.find((uint32_t)(uintptr_t)data);
+	if(itr != addonData->outstandingJobs.end()) {
+		itr->second->cancel();
+	}
+	return getUndefined(env);
+}
+
+// Registers the job and returns a handle object with a cancel() method
+napi_value newJobHandle(napi_env env, CancellableJob* job) {
+	AddonData* addonData = getAddonData(env);
+	job->jobId = addonData->nextJobId++;
+	addonData->outstandingJobs[job->jobId] = job;
+	napi_value handle = newObject(env);
+	napi_value cancelFn;
+	napi_create_function(env, "cancel", NAPI_AUTO_LENGTH, nodeCancelJob, (void*)(uintptr_t)job->jobId, &cancelFn);
+	setNamed(env, handle, "cancel", cancelFn);
+	return handle;
+}
+
+void unregisterJob(napi_env env, CancellableJob* job) {
+	getAddonData(env)->outstandingJobs.erase(job->jobId);
+}
+
+struct SingleRequest;
+
+void cancelWaiting(napi_env env, SimData* simData);
+
+// A caller waiting for the results of a SimData: a runSimulation() call or one slot of a batch
+struct Subscriber {
+	SingleRequest* request = 0;
+	BatchData* batch = 0;
+	uint32_t batchIndex = 0;
+	bool cancelled = false;
+};
+
+struct SimData : public SimulationListener {
+	napi_env env;
+	napi_async_work work = nullptr;
+
+	// Identical requests made while the simulation is queued or running subscribe to it instead of
+	// simulating again.  coalesceKey is empty if its results are specific to one caller.
+	std::vector<Subscriber> subscribers;
+	std::string coalesceKey;
+
+	// Set when the caller passed an onFirstRun callback.  The worker stores the first run's results
+	// and wakes the loop through firstRunFunction, whose finalizer deletes the SimData; the loop
+	// thread cancels the token if the callback returns false.
+	napi_ref firstRunCallback = nullptr;
+	napi_threadsafe_function firstRunFunction = nullptr;
+	std::mutex firstRunMutex;
+	bool firstRunReady = false;
+	bool firstRunDelivered = false;
+	SimulationResults firstRunResults;
+	RunUntilStopReason firstRunStopReason;
+
+	CancellationToken token;
 
 	std::shared_ptr<Reactor> reactor;
+	SimulationOptions simOptions;
 	SimulationResults simResults;
+
+	std::unique_ptr<StressReport> stress;
+	std::unique_ptr<ReactorSnapshot> initialState;
+	std::unique_ptr<RingTraceSink> ringTrace;
+	std::unique_ptr<FileTraceSink> fileTrace;
+
+	std::chrono::steady_clock::time_point queuedAt;
+	Lane lane = LANE_INTERACTIVE;
+	int predictedTicks = -1;	// estimateSimulationTicks(), set when queued
+	bool completed = false;		// waiting for deliverCompleted()
+
+	SimData(napi_env env) : env(env) {}
+
+	void onFirstRun(const SimulationResults& partialResults, RunUntilStopReason stopReason) {
+		{
+			std::lock_guard<std::mutex> lock(firstRunMutex);
+			firstRunResults = partialResults;
+			firstRunStopReason = stopReason;
+			firstRunReady = true;
+		}
+		napi_call_threadsafe_function(firstRunFunction, nullptr, napi_tsfn_nonblocking);
+	}
+
+	size_t subscribe(const Subscriber& subscriber) {
+		subscribers.push_back(subscriber);
+		return subscribers.size() - 1;
+	}
+
+	// The simulation is only cancelled once all of its subscribers have cancelled.  Subscribers
+	// that cancelled while others still wait receive the shared results.
+	void cancelSubscriber(size_t index) {
+		subscribers[index].cancelled = true;
+		for(const Subscriber& subscriber : subscribers) {
+			if(!subscriber.cancelled) return;
+		}
+		cancel();
+	}
+
+	bool allCancelled() {
+		return token.isCancelled();
+	}
+
+	// Cancels the simulation if it is running, or takes it off the queue if it has not started
+	void cancel() {
+		if(completed) return;
+		token.cancel();
+		if(work) {
+			napi_cancel_async_work(env, work);
+		} else {
+			cancelWaiting(env, this);
+		}
+	}
+};
+
+struct SingleRequest : public CancellableJob {
+	napi_ref callback = nullptr;
+	SimData* simData = 0;
+	size_t subscriber = 0;
+
+	void cancel() {
+		simData->cancelSubscriber(subscriber);
+	}
+};
+
+struct BatchItem {
+	SimData* simData;	// null once finished
+	size_t subscriber;
+};
+
+struct BatchData : public CancellableJob {
+	napi_ref callback = nullptr;
+	napi_ref results = nullptr;	// an array, or with results: 'columns' a Float64Array of slots
+	bool columns = false;
+	std::vector<BatchItem> items;
+	uint32_t remaining = 0;
+
+	// With the resultsFile option, each slot's own layout (a coalesced simulation may have run an
+	// equivalent one) and results, appended in order once all are in unless the batch is cancelled
+	std::string resultsFile;
+	std::vector<std::shared_ptr<Reactor>> reactors;
+	std::vector<SimulationResults> fileResults;
+	napi_async_work appendWork = nullptr;
+	std::string appendError;
+	bool cancelled = false;
+
+	void cancel() {
+		cancelled = true;
+		for(BatchItem& item : items) {
+			if(item.simData) item.simData->cancelSubscriber(item.subscriber);
+		}
+	}
 };
 
-void runSimWork(uv_work_t* req) {
-	SimData* simData = static_cast<SimData*>(req->data);
-	simData->simResults = runSimulation(*(simData->reactor));
+// Calls onFirstRun once, from whichever of the threadsafe function and the completion runs first
+void deliverFirstRun(napi_env env, SimData* simData) {
+	napi_value partial;
+	{
+		std::lock_guard<std::mutex> lock(simData->firstRunMutex);
+		if(!simData->firstRunReady || simData->firstRunDelivered) return;
+		simData->firstRunDelivered = true;
+		partial = firstRunResultsToObject(env, simData->firstRunResults, simData->firstRunStopReason);
+	}
+
+	napi_value callback, global, ret;
+	napi_get_reference_value(env, simData->firstRunCallback, &callback);
+	napi_get_global(env, &global);
+	if(napi_call_function(env, global, callback, 1, &partial, &ret) != napi_ok) {
+		reportCallbackException(env);
+		return;
+	}
+	napi_valuetype type;
+	bool value = true;
+	napi_typeof(env, ret, &type);
+	if(type == napi_boolean) napi_get_value_bool(env, ret, &value);
+	if(!value) {
+		simData->token.cancel();
+	}
+}
+
+void callFirstRun(napi_env env, napi_value jsCallback, void* context, void* data) {
+	if(!env) return;	// environment shutting down
+	deliverFirstRun(env, static_cast<SimData*>(context));
+}
+
+void finalizeFirstRun(napi_env env, void* finalizeData, void* hint) {
+	delete static_cast<SimData*>(finalizeData);
+}
+
+void callCallbackError(napi_env env, napi_ref callbackRef, const std::string& message) {
+	napi_value callback, global, cbArgs[1];
+	napi_get_reference_value(env, callbackRef, &callback);
+	napi_get_global(env, &global);
+	napi_create_error(env, nullptr, newString(env, message.c_str()), &cbArgs[0]);
+	napi_call_function(env, global, callback, 1, cbArgs, nullptr);
+	reportCallbackException(env);
 }
 
-void runSimAfter(uv_work_t* req, int status) {
-	HandleScope scope;
-	SimData* simData = static_cast<SimData*>(req->data);
-	Local<Object> results = simResultsToV8Object(simData->simResults);
+void callCallback(napi_env env, napi_ref callbackRef, napi_value results) {
+	napi_value callback, global, cbArgs[2];
+	napi_get_reference_value(env, callbackRef, &callback);
+	napi_get_global(env, &global);
+	napi_get_null(env, &cbArgs[0]);
+	cbArgs[1] = results;
+	napi_call_function(env, global, callback, 2, cbArgs, nullptr);
+	reportCallbackException(env);
+}
 
-	// Call callback
-	Local<Value> cbArgs[] = { Local<Value>::New(Null()), results };
-	TryCatch tryCatch;
-	simData->callback->Call(Context::GetCurrent()->Global(), 2, cbArgs);
-	if(tryCatch.HasCaught()) {
-		node::FatalException(tryCatch);
+void runSimExecute(napi_env env, void* data) {
+	SimData* simData = static_cast<SimData*>(data);
+	int64_t waitNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - simData->queuedAt).count();
+	SIM_PROBE2(queue__dequeue, (uintptr_t)simData, waitNanos);
+	statIncrement(STAT_QUEUED_JOBS);
+	statAdd(STAT_QUEUE_WAIT_NANOS, waitNanos);
+	statIncrement(STAT_LANE_JOBS + simData->lane);
+	statAdd(STAT_LANE_WAIT_NANOS + simData->lane, waitNanos);
+	simData->simResults = runSimulation(*(simData->reactor), simData->simOptions);
+	if(!simData->simResults.incomplete) {
+		recordCostEstimate(simData->predictedTicks, simData->token.getTicksUsed());
 	}
+	simData->fileTrace.reset();	// flush and close before the callback sees the file
+}
+
+// Fields of a results object in the Float64Array the factory builds it from; see simresults.js
+enum ResultSlot {
+	SLOT_EFFICIENCY,
+	SLOT_TOTAL_EU_PER_CYCLE,
+	SLOT_EU_PER_TICK,
+	SLOT_OVERALL_EU_PER_TICK,
+	SLOT_USES_SINGLE_USE_COOLANT,
+	SLOT_TIMED_OUT,
+	SLOT_COOLDOWN_TICKS,
+	SLOT_CYCLE_TICKS,
+	SLOT_MARK,
+	SLOT_NUM_ITERATIONS_BEFORE_FAILURE,
+	SLOT_TICKS_UNTIL_MELTDOWN,
+	SLOT_TICKS_UNTIL_COMPONENT_FAILURE,
+	SLOT_TOTAL_COST,
+	SLOT_INCOMPLETE,
+	SLOT_REJECT_REASON,
+	SLOT_INCOMPLETE_REASON,	// -1 if complete
+	SLOT_PREDICTED_TICKS,	// -1 if not estimated
+	SLOT_SIMULATED_TICKS,
+	SLOT_COUNT
+};
 
-	simData->callback.Dispose();
-	delete simData;
+// Float64Array shared by the results objects created together, such as those of one delivery.
+// Filled in order; a new one is started if more objects are created than it was sized for.
+struct ResultsArena {
+	napi_value values = nullptr;
+	double* data = nullptr;
+	size_t used = 0;
+	size_t capacity = 0;
+	size_t sizeHint;
+
+	ResultsArena(size_t sizeHint) : sizeHint(sizeHint) {}
+
+	// Returns the next free slot and its index in values
+	double* allocate(napi_env env, uint32_t& index) {
+		if(used == capacity) {
+			capacity = std::max(sizeHint, (size_t)1);
+			values = newTypedArray(env, napi_float64_array, sizeof(double), capacity * SLOT_COUNT, (void**)&data);
+			used = 0;
+		}
+		index = used;
+		return data + SLOT_COUNT * used++;
+	}
+};
+
+// Writes the results of a simulation to a slot of SLOT_COUNT values
+void fillResultSlot(double* slot, SimData* simData) {
+	SimulationResults& results = simData->simResults;
+	slot[SLOT_EFFICIENCY] = results.efficiency;
+	slot[SLOT_TOTAL_EU_PER_CYCLE] = results.totalEUPerCycle;
+	slot[SLOT_EU_PER_TICK] = results.euPerTick;
+	slot[SLOT_OVERALL_EU_PER_TICK] = results.overallEUPerTick;
+	slot[SLOT_USES_SINGLE_USE_COOLANT] = results.usesSingleUseCoolant;
+	slot[SLOT_TIMED_OUT] = results.timedOut;
+	slot[SLOT_COOLDOWN_TICKS] = results.cooldownTicks;
+	slot[SLOT_CYCLE_TICKS] = results.cycleTicks;
+	slot[SLOT_MARK] = results.mark;
+	slot[SLOT_NUM_ITERATIONS_BEFORE_FAILURE] = results.numIterationsBeforeFailure;
+	slot[SLOT_TICKS_UNTIL_MELTDOWN] = results.ticksUntilMeltdown;
+	slot[SLOT_TICKS_UNTIL_COMPONENT_FAILURE] = results.ticksUntilComponentFailure;
+	slot[SLOT_TOTAL_COST] = results.totalCost;
+	slot[SLOT_INCOMPLETE] = results.incomplete;
+	slot[SLOT_REJECT_REASON] = results.rejected;
+	slot[SLOT_INCOMPLETE_REASON] = results.incomplete ? simData->token.getReason() : -1;
+	slot[SLOT_PREDICTED_TICKS] = simData->predictedTicks;
+	slot[SLOT_SIMULATED_TICKS] = simData->token.getTicksUsed();
 }
 
-Handle<Value> nodeRunSimulation(const Arguments& args) {
-	HandleScope scope;
+// A results object built by the factory from a slot of the arena
+napi_value newFactoryResults(napi_env env, napi_value resultsFactory, ResultsArena& arena, SimData* simData) {
+	uint32_t index;
+	fillResultSlot(arena.allocate(env, index), simData);
+	napi_value args[2] = { arena.values, newInt(env, index) }, obj;
+	napi_call_function(env, getUndefined(env), resultsFactory, 2, args, &obj);
+	return obj;
+}
 
-	if(args.Length() != 2) {
-		ThrowException(Exception::TypeError(String::New("Wrong number of arguments")));
-		return scope.Close(Undefined());
+// Results object of a simulation: built through the arena if the factory is registered, otherwise
+// with a property set per field
+napi_value simDataResultsToObject(napi_env env, SimData* simData, ResultsArena& arena) {
+	napi_value results;
+	AddonData* addonData = getAddonData(env);
+	if(addonData->resultsFactory) {
+		napi_value resultsFactory;
+		napi_get_reference_value(env, addonData->resultsFactory, &resultsFactory);
+		results = newFactoryResults(env, resultsFactory, arena, simData);
+	} else {
+		results = simResultsToObject(env, simData->simResults);
+		if(simData->simResults.incomplete) {
+			setNamed(env, results, "incompleteReason", newString(env, cancelReasonNames[simData->token.getReason()]));
+		}
+		if(simData->predictedTicks >= 0) {
+			setNamed(env, results, "predictedTicks", newInt(env, simData->predictedTicks));
+			setNamed(env, results, "simulatedTicks", newNumber(env, simData->token.getTicksUsed()));
+		}
+	}
+	if(simData->stress) {
+		setNamed(env, results, "stress", stressToObject(env, *simData->stress));
 	}
+	if(simData->ringTrace) {
+		setNamed(env, results, "trace", traceToObject(env, *simData->ringTrace));
+	}
+	return results;
+}
+
+void dispatchWaiting(napi_env env);
 
-	if(!args[0]->IsArray()) {
-		ThrowException(Exception::TypeError(String::New("Argument must be array")));
-		return scope.Close(Undefined());
+void callBatchBack(napi_env env, BatchData* batch) {
+	if(batch->appendError.empty()) {
+		napi_value batchResults;
+		napi_get_reference_value(env, batch->results, &batchResults);
+		callCallback(env, batch->callback, batchResults);
+	} else {
+		callCallbackError(env, batch->callback, batch->appendError);
 	}
+	napi_delete_reference(env, batch->callback);
+	napi_delete_reference(env, batch->results);
+	delete batch;
+}
 
-	if(!args[1]->IsFunction()) {
-		ThrowException(Exception::TypeError(String::New("Second argument must be callback")));
-		return scope.Close(Undefined());
+void appendResultsExecute(napi_env env, void* data) {
+	BatchData* batch = static_cast<BatchData*>(data);
+	ResultsFileWriter writer;
+	for(size_t i = 0; i < batch->reactors.size(); ++i) {
+		writer.add(batch->reactors[i]->getComponentTypes(), batch->reactors[i]->width, batch->fileResults[i]);
 	}
+	writer.append(batch->resultsFile, batch->appendError);
+}
 
-	Local<Function> callback = Local<Function>::Cast(args[1]);
+void appendResultsComplete(napi_env env, napi_status status, void* data) {
+	BatchData* batch = static_cast<BatchData*>(data);
+	napi_delete_async_work(env, batch->appendWork);
+	callBatchBack(env, batch);
+}
 
-	Handle<Array> componentArray = args[0].As<Array>();
-	uint32_t len = componentArray->Length();
+// Calls back once the results are appended to the batch's file, which is done on the thread pool
+void finishBatch(napi_env env, BatchData* batch) {
+	unregisterJob(env, batch);
+	if(!batch->resultsFile.empty() && !batch->cancelled && !batch->reactors.empty()) {
+		napi_create_async_work(env, nullptr, newString(env, "reactorsim-results-file"), appendResultsExecute, appendResultsComplete, batch, &batch->appendWork);
+		napi_queue_async_work(env, batch->appendWork);
+		return;
+	}
+	callBatchBack(env, batch);
+}
+
+// Calls back every subscriber of a completed simulation and frees it
+void deliverSimData(napi_env env, SimData* simData, ResultsArena& arena) {
+	if(simData->firstRunCallback) {
+		deliverFirstRun(env, simData);
+	}
+
+	// Each subscriber gets its own results object, or slot of a columns batch.  Indexed, since
+	// callbacks may subscribe more.
+	for(size_t i = 0; i < simData->subscribers.size(); ++i) {
+		Subscriber subscriber = simData->subscribers[i];
+		BatchData* batch = subscriber.batch;
+		if(batch) {
+			napi_value batchResults;
+			napi_get_reference_value(env, batch->results, &batchResults);
+			if(batch->columns) {
+				void* data;
+				napi_get_typedarray_info(env, batchResults, nullptr, nullptr, &data, nullptr, nullptr);
+				fillResultSlot(static_cast<double*>(data) + SLOT_COUNT * subscriber.batchIndex, simData);
+			} else {
+				napi_set_element(env, batchResults, subscriber.batchIndex, simDataResultsToObject(env, simData, arena));
+			}
+			batch->items[subscriber.batchIndex].simData = 0;
+			if(!batch->resultsFile.empty()) batch->fileResults[subscriber.batchIndex] = simData->simResults;
+			if(--batch->remaining == 0) {
+				finishBatch(env, batch);
+			}
+		} else {
+			SingleRequest* request = subscriber.request;
+			unregisterJob(env, request);
+			callCallback(env, request->callback, simDataResultsToObject(env, simData, arena));
+			napi_delete_reference(env, request->callback);
+			delete request;
+		}
+	}
+
+	if(simData->firstRunFunction) {
+		napi_delete_reference(env, simData->firstRunCallback);
+		napi_release_threadsafe_function(simData->firstRunFunction, napi_tsfn_release);
+	} else {
+		delete simData;
+	}
+}
+
+// Delivers the completed simulations together, in one callback scope, so that the per-callback
+// cost of entering JS (async hooks, the nextTick queue and microtasks) is paid once per batch
+void deliverCompleted(uv_timer_t* timer) {
+	napi_env env = static_cast<napi_env>(timer->data);
+	AddonData* addonData = getAddonData(env);
+	std::vector<SimData*> completed;
+	std::vector<BatchData*> emptyBatches;
+	completed.swap(addonData->completed);
+	emptyBatches.swap(addonData->emptyBatches);
+	statIncrement(STAT_DELIVERY_FLUSHES);
+	statAdd(STAT_DELIVERED_SIMULATIONS, completed.size());
+
+	napi_handle_scope handleScope;
+	napi_callback_scope callbackScope;
+	napi_value resource;
+	napi_open_handle_scope(env, &handleScope);
+	napi_create_object(env, &resource);
+	napi_open_callback_scope(env, resource, addonData->deliveryContext, &callbackScope);
+	size_t numResults = 0;
+	for(SimData* simData : completed) numResults += simData->subscribers.size();
+	ResultsArena arena(numResults);
+	for(SimData* simData : completed) {
+		deliverSimData(env, simData, arena);
+	}
+	for(BatchData* batch : emptyBatches) {
+		finishBatch(env, batch);
+	}
+	napi_close_callback_scope(env, callbackScope);
+	napi_close_handle_scope(env, handleScope);
+}
+
+void closeDeliveryTimer(void* data) {
+	AddonData* addonData = static_cast<AddonData*>(data);
+	napi_async_destroy(static_cast<napi_env>(addonData->deliveryTimer->data), addonData->deliveryContext);
+	uv_close((uv_handle_t*)addonData->deliveryTimer, [](uv_handle_t* handle) { delete (uv_timer_t*)handle; });
+	addonData->deliveryTimer = nullptr;
+}
+
+// Starts the delivery timer unless it is already running
+void startDelivery(napi_env env) {
+	AddonData* addonData = getAddonData(env);
+	if(!addonData->deliveryTimer) {
+		uv_loop_s* loop;
+		napi_get_uv_event_loop(env, &loop);
+		addonData->deliveryTimer = new uv_timer_t;
+		uv_timer_init(loop, addonData->deliveryTimer);
+		addonData->deliveryTimer->data = env;
+		napi_async_init(env, nullptr, newString(env, "reactorsim-delivery"), &addonData->deliveryContext);
+		napi_add_env_cleanup_hook(env, closeDeliveryTimer, addonData);
+	}
+	if(!uv_is_active((uv_handle_t*)addonData->deliveryTimer)) {
+		uv_timer_start(addonData->deliveryTimer, deliverCompleted, addonData->maxDeliveryLatency, 0);
+	}
+}
+
+// Queues a completed simulation for delivery
+void scheduleDelivery(napi_env env, SimData* simData) {
+	getAddonData(env)->completed.push_back(simData);
+	startDelivery(env);
+}
+
+// Runs once per simulation as the thread pool hands it back.  Only does the bookkeeping that must
+// not wait, and leaves the callbacks to deliverCompleted().
+void runSimComplete(napi_env env, napi_status status, void* data) {
+	SimData* simData = static_cast<SimData*>(data);
+	// Before the callbacks, so the thread is given new work as soon as possible
+	getAddonData(env)->dispatched[simData->lane]--;
+	dispatchWaiting(env);
+	if(!simData->coalesceKey.empty()) {
+		std::unordered_map<std::string, SimData*>& inFlight = getAddonData(env)->inFlight;
+		std::unordered_map<std::string, SimData*>::iterator itr = inFlight.find(simData->coalesceKey);
+		if(itr != inFlight.end() && itr->second == simData) inFlight.erase(itr);
+	}
+	if(status == napi_cancelled) {
+		// Cancelled before it started
+		statIncrement(STAT_CANCELLED_QUEUED_JOBS);
+		simData->simResults.incomplete = true;
+	}
+	// Cancelling a subscriber from now on has no effect on the results
+	napi_delete_async_work(env, simData->work);
+	simData->work = nullptr;
+	simData->completed = true;
+	scheduleDelivery(env, simData);
+}
+
+// Identifies a simulation by its layout and the options that affect its results.  Layouts proven
+// equivalent share a key, except with stress reports, which are per cell.
+std::string getCoalesceKey(Reactor& reactor, const SimulationOptions& options) {
+	std::vector<ComponentType> types = reactor.getComponentTypes();
+	if(!options.stress) types = canonicalizeLayout(types, reactor.width, reactor.height);
+	std::string key(1, (char)reactor.width);
+	for(ComponentType type : types) key.push_back((char)type);
+	key += options.exactCycles ? "e" + std::to_string(options.maxCycles) : "-";
+	if(options.stress) key += "s";
+	const SimulationThresholds& thresholds = options.thresholds;
+	key += "t" + std::to_string(thresholds.minEUPerTick) + "," + std::to_string(thresholds.minOverallEUPerTick) + "," + std::to_string(thresholds.maxMark);
+	return key;
+}
+
+// Returns a queued or running simulation the new one can subscribe to instead, or null.  Sets up
+// the new one's coalescing key if it can be shared.
+SimData* findCoalescable(napi_env env, SimData* simData, bool shareable) {
+	if(!shareable) return 0;
+	simData->coalesceKey = getCoalesceKey(*simData->reactor, simData->simOptions);
+	std::unordered_map<std::string, SimData*>& inFlight = getAddonData(env)->inFlight;
+	std::unordered_map<std::string, SimData*>::iterator itr = inFlight.find(simData->coalesceKey);
+	if(itr == inFlight.end() || itr->second->allCancelled()) return 0;
+	statIncrement(STAT_COALESCED_SIMULATIONS);
+	return itr->second;
+}
+
+// Makes a shareable simulation findable by findCoalescable()
+void registerInFlight(napi_env env, SimData* simData) {
+	if(!simData->coalesceKey.empty()) {
+		getAddonData(env)->inFlight[simData->coalesceKey] = simData;
+	}
+}
+
+// Hands the simulation to the thread pool
+void dispatchSimData(napi_env env, SimData* simData) {
+	napi_create_async_work(env, nullptr, newString(env, "reactorsim"), runSimExecute, runSimComplete, simData, &simData->work);
+	getAddonData(env)->dispatched[simData->lane]++;
+	napi_queue_async_work(env, simData->work);
+}
+
+// Hands over waiting simulations, interactive first, as far as the lane limits allow
+void dispatchWaiting(napi_env env) {
+	AddonData* addonData = getAddonData(env);
+	std::deque<SimData*>& interactive = addonData->waiting[LANE_INTERACTIVE];
+	while(!interactive.empty()) {
+		SimData* simData = interactive.front();
+		interactive.pop_front();
+		dispatchSimData(env, simData);
+	}
+	std::deque<SimData*>& bulk = addonData->waiting[LANE_BULK];
+	while(!bulk.empty() && addonData->dispatched[LANE_BULK] < addonData->getBulkLimit()) {
+		SimData* simData = bulk.front();
+		bulk.pop_front();
+		dispatchSimData(env, simData);
+	}
+}
+
+// A cancelled simulation that is still waiting is handed over and cancelled right away, so that it
+// completes like one taken off the thread pool queue
+void cancelWaiting(napi_env env, SimData* simData) {
+	std::deque<SimData*>& waiting = getAddonData(env)->waiting[simData->lane];
+	std::deque<SimData*>::iterator itr = std::find(waiting.begin(), waiting.end(), simData);
+	if(itr == waiting.end()) return;
+	waiting.erase(itr);
+	dispatchSimData(env, simData);
+	napi_cancel_async_work(env, simData->work);
+}
+
+// Moves a waiting simulation that an interactive caller subscribed to into the interactive lane
+void raiseLane(napi_env env, SimData* simData, Lane lane) {
+	if(lane >= simData->lane || simData->work) return;
+	std::deque<SimData*>& waiting = getAddonData(env)->waiting[simData->lane];
+	waiting.erase(std::find(waiting.begin(), waiting.end(), simData));
+	simData->lane = lane;
+	getAddonData(env)->waiting[lane].push_back(simData);
+	dispatchWaiting(env);
+}
+
+void queueSimData(napi_env env, SimData* simData) {
+	registerInFlight(env, simData);
+	if(simData->predictedTicks < 0) {
+		simData->predictedTicks = estimateSimulationTicks(*simData->reactor, simData->simOptions);
+	}
+	simData->reactor->cancelToken = &simData->token;
+	simData->queuedAt = std::chrono::steady_clock::now();
+	SIM_PROBE1(queue__enqueue, (uintptr_t)simData);
+	getAddonData(env)->waiting[simData->lane].push_back(simData);
+	dispatchWaiting(env);
+}
+
+
+// Subscribes a runSimulation() call to a coalescable simulation in flight, or else queues its own,
+// and returns the call's handle
+napi_value queueRequest(napi_env env, std::unique_ptr<SimData>& simData, bool shareable, napi_value callback) {
+	SingleRequest* request = new SingleRequest();
+	napi_create_reference(env, callback, 1, &request->callback);
+	Subscriber subscriber;
+	subscriber.request = request;
+	request->simData = findCoalescable(env, simData.get(), shareable);
+	if(request->simData) {
+		raiseLane(env, request->simData, simData->lane);
+	} else {
+		request->simData = simData.release();
+		queueSimData(env, request->simData);
+	}
+	request->subscriber = request->simData->subscribe(subscriber);
+
+	return newJobHandle(env, request);
+}
+
+
+/***** Arguments *****/
+
+// Reads a component code from a string or String object into buf.  Returns false if it is neither.
+bool readComponentCode(napi_env env, napi_value val, char* buf, size_t bufSize) {
+	napi_valuetype type;
+	napi_typeof(env, val, &type);
+	if(type == napi_object) {
+		napi_value global, stringCtor;
+		bool isStringObject = false;
+		napi_get_global(env, &global);
+		napi_get_named_property(env, global, "String", &stringCtor);
+		napi_instanceof(env, val, stringCtor, &isStringObject);
+		if(!isStringObject) return false;
+		napi_coerce_to_string(env, val, &val);
+	} else if(type != napi_string) {
+		return false;
+	}
+	size_t written = 0;
+	napi_get_value_string_latin1(env, val, buf, bufSize, &written);
+	buf[written] = 0;
+	return true;
+}
+
+// Converts an array of component codes into a reactor.  Throws and returns null on invalid input.
+std::shared_ptr<Reactor> reactorFromValue(napi_env env, napi_value arg) {
+	bool isArray = false;
+	napi_is_array(env, arg, &isArray);
+	if(!isArray) {
+		napi_throw_type_error(env, nullptr, "Argument must be array");
+		return std::shared_ptr<Reactor>();
+	}
+
+	uint32_t len = 0;
+	napi_get_array_length(env, arg, &len);
 
 	if(len % 6 != 0 || len < 3*6 || len > 9*6) {
-		ThrowException(Exception::TypeError(String::New("Invalid number of components")));
-		return scope.Close(Undefined());
+		napi_throw_type_error(env, nullptr, "Invalid number of components");
+		return std::shared_ptr<Reactor>();
 	}
 
 	int extraChambers = len / 6 - 3;
@@ -101,44 +981,1039 @@ Handle<Value> nodeRunSimulation(const Arguments& args) {
 	components.reserve(len);
 	char buf[10];
 	for(uint32_t i = 0; i < len; i++) {
-		Local<Value> val = componentArray->Get(i);
-		Local<String> valString;
-		if(val->IsString()) {
-			valString = val.As<String>();
-		} else if(val->IsStringObject()) {
-			valString = val.As<StringObject>()->StringValue();
-		} else {
-			ThrowException(Exception::TypeError(String::New("Components must be string codes")));
-			return scope.Close(Undefined());
+		napi_value val;
+		napi_get_element(env, arg, i, &val);
+		if(!readComponentCode(env, val, buf, sizeof(buf))) {
+			napi_throw_type_error(env, nullptr, "Components must be string codes");
+			return std::shared_ptr<Reactor>();
 		}
-		int written = valString->WriteAscii(buf, 0, 9);
-		buf[written] = 0;
 		std::string stlString(buf);
 		if(!isValidComponentTypeAbbr(stlString)) {
-			ThrowException(Exception::TypeError(String::New((std::string("Invalid component code: ") + stlString).c_str())));
-			return scope.Close(Undefined());
+			napi_throw_type_error(env, nullptr, (std::string("Invalid component code: ") + stlString).c_str());
+			return std::shared_ptr<Reactor>();
 		}
-		ComponentType type = getComponentTypeByAbbr(stlString);
-		components.push_back(type);
+		components.push_back(getComponentTypeByAbbr(stlString));
 	}
 
 	reactor->setComponentTypes(components);
+	return reactor;
+}
 
-	SimData* simData = new SimData();
-	simData->request.data = simData;
-	simData->callback = Persistent<Function>::New(callback);
+// Reads the Uint8Array property of a packed layouts object.  Throws and returns null if missing.
+uint8_t* getPackedBytes(napi_env env, napi_value packed, const char* name, size_t& length) {
+	napi_value value = getOption(env, packed, name);
+	bool isTypedArray = false;
+	if(value) napi_is_typedarray(env, value, &isTypedArray);
+	napi_typedarray_type type;
+	void* data = nullptr;
+	if(isTypedArray) napi_get_typedarray_info(env, value, &type, &length, &data, nullptr, nullptr);
+	if(!isTypedArray || type != napi_uint8_array) {
+		napi_throw_type_error(env, nullptr, (std::string("Packed layouts must have a Uint8Array ") + name).c_str());
+		return nullptr;
+	}
+	return static_cast<uint8_t*>(data);
+}
+
+// Converts packed layouts, as returned by loadGridFile(), into reactors.  Throws and returns false on
+// invalid input.
+bool reactorsFromPacked(napi_env env, napi_value packed, std::vector<std::shared_ptr<Reactor>>& reactors) {
+	size_t numLayouts, numTypes;
+	uint8_t* widths = getPackedBytes(env, packed, "widths", numLayouts);
+	if(!widths) return false;
+	uint8_t* types = getPackedBytes(env, packed, "types", numTypes);
+	if(!types) return false;
+	size_t pos = 0;
+	vector<ComponentType> components;
+	for(size_t i = 0; i < numLayouts; ++i) {
+		size_t len = widths[i] * 6;
+		if(widths[i] < 3 || widths[i] > 9 || pos + len > numTypes) {
+			napi_throw_type_error(env, nullptr, "Invalid packed layout widths");
+			return false;
+		}
+		components.clear();
+		for(size_t j = 0; j < len; ++j) {
+			if(types[pos + j] >= COMPONENT_COUNT) {
+				napi_throw_type_error(env, nullptr, "Invalid packed component type");
+				return false;
+			}
+			components.push_back((ComponentType)types[pos + j]);
+		}
+		pos += len;
+		std::shared_ptr<Reactor> reactor(new Reactor(widths[i] - 3));
+		reactor->setComponentTypes(components);
+		reactors.push_back(reactor);
+	}
+	if(pos != numTypes) {
+		napi_throw_type_error(env, nullptr, "Packed types do not match the layout widths");
+		return false;
+	}
+	return true;
+}
+
+// The maxTicks and timeout options.  Returns whether either is set.
+bool readBudgetOptions(napi_env env, napi_value options, CancellationToken& token) {
+	bool budgeted = false;
+	napi_value value;
+	if((value = getOption(env, options, "maxTicks"))) {
+		token.setTickBudget((uint64_t)toInt64(env, value));
+		budgeted = true;
+	}
+	if((value = getOption(env, options, "timeout"))) {
+		// Counted from the call, so it includes time spent waiting in the queue
+		token.setDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(toInt64(env, value)));
+		budgeted = true;
+	}
+	return budgeted;
+}
+
+// The priority option, "interactive" or "bulk".  Throws and returns false on anything else.
+bool readLane(napi_env env, napi_value options, Lane& lane) {
+	napi_value value = getOption(env, options, "priority");
+	if(!value) return true;
+	std::string name = toUtf8(env, value);
+	for(int i = 0; i < numLanes; ++i) {
+		if(name == laneNames[i]) {
+			lane = (Lane)i;
+			return true;
+		}
+	}
+	napi_throw_type_error(env, nullptr, "priority must be \"interactive\" or \"bulk\"");
+	return false;
+}
+
+// Reads one array of an initial state: a value per cell, 0 for every cell if absent
+bool readCellValues(napi_env env, napi_value state, const char* name, size_t numCells, std::vector<int>& values) {
+	values.assign(numCells, 0);
+	napi_value arr = getOption(env, state, name);
+	if(!arr) return true;
+	napi_value lengthValue;
+	uint32_t length = 0;
+	if(napi_get_named_property(env, arr, "length", &lengthValue) == napi_ok) napi_get_value_uint32(env, lengthValue, &length);
+	if(length != numCells) {
+		napi_throw_type_error(env, nullptr, (std::string("initial state ") + name + " must have a value per cell").c_str());
+		return false;
+	}
+	for(uint32_t i = 0; i < length; ++i) {
+		napi_value value;
+		napi_get_element(env, arr, i, &value);
+		int64_t v = toInt64(env, value);
+		if(v < 0 || v > INT32_MAX) {
+			napi_throw_range_error(env, nullptr, (std::string("initial state ") + name + " must not be negative").c_str());
+			return false;
+		}
+		values[i] = (int)v;
+	}
+	return true;
+}
+
+// Reads an initial state, { reactorHeat, cellHeat, cellUsage }, for a reactor.  Throws and returns
+// false if it is invalid.
+bool readInitialState(napi_env env, napi_value value, const Reactor& reactor, ReactorSnapshot& state) {
+	napi_valuetype type;
+	napi_typeof(env, value, &type);
+	if(type != napi_object) {
+		napi_throw_type_error(env, nullptr, "Initial state must be an object");
+		return false;
+	}
+	size_t numCells = reactor.components.size();
+	napi_value heat;
+	state.reactorHeat = (heat = getOption(env, value, "reactorHeat")) ? (int)toInt64(env, heat) : 0;
+	if(state.reactorHeat < 0) {
+		napi_throw_range_error(env, nullptr, "initial state reactorHeat must not be negative");
+		return false;
+	}
+	state.cellPresent.assign(numCells, 1);
+	return readCellValues(env, value, "cellHeat", numCells, state.cellHeat) && readCellValues(env, value, "cellUsage", numCells, state.cellUsage);
+}
+
+// Starts the simulation from the given state instead of a cold reactor with fresh fuel
+void setInitialState(SimData* simData, const ReactorSnapshot& state) {
+	simData->initialState.reset(new ReactorSnapshot(state));
+	simData->simOptions.initialState = simData->initialState.get();
+}
+
+// Reads the initialState option.  Throws and returns false if it is invalid.  Simulations from an
+// initial state are not shared.
+bool readInitialStateOption(napi_env env, napi_value options, SimData* simData, bool& shareable) {
+	napi_value value = getOption(env, options, "initialState");
+	if(!value) return true;
+	ReactorSnapshot state;
+	if(!readInitialState(env, value, *simData->reactor, state)) return false;
+	setInitialState(simData, state);
+	shareable = false;
+	return true;
+}
+
+// Options shared by runSimulation() and runSimulationBatch().  Returns whether the results may be
+// shared with other callers, which is not the case with budgets or with coalesce: false.
+bool readSimOptions(napi_env env, napi_value options, SimData* simData) {
+	bool shareable = true;
+	napi_value value;
+	if((value = getOption(env, options, "exactCycles"))) {
+		simData->simOptions.exactCycles = toBool(env, value);
+	}
+	if((value = getOption(env, options, "maxCycles"))) {
+		simData->simOptions.maxCycles = (int)toInt64(env, value);
+	}
+	if((value = getOption(env, options, "stress")) && toBool(env, value)) {
+		simData->stress.reset(new StressReport());
+		simData->simOptions.stress = simData->stress.get();
+	}
+	if((value = getOption(env, options, "thresholds"))) {
+		napi_value thresholds;
+		napi_coerce_to_object(env, value, &thresholds);
+		SimulationThresholds& t = simData->simOptions.thresholds;
+		if((value = getOption(env, thresholds, "minEUPerTick"))) t.minEUPerTick = (int)toInt64(env, value);
+		if((value = getOption(env, thresholds, "minOverallEUPerTick"))) t.minOverallEUPerTick = (int)toInt64(env, value);
+		if((value = getOption(env, thresholds, "maxMark"))) t.maxMark = (int)toInt64(env, value);
+	}
+	if(readBudgetOptions(env, options, simData->token)) {
+		shareable = false;
+	}
+	if((value = getOption(env, options, "coalesce")) && !toBool(env, value)) {
+		shareable = false;
+	}
+	return shareable;
+}
+
+// Reads the arguments shared by runSimulation() and runSimulationBatch(): the layout(s), an
+// optional options object, and the callback.  Throws and returns false on invalid arguments.
+bool readArguments(napi_env env, napi_callback_info info, napi_value& first, napi_value& options, napi_value& callback) {
+	size_t argc = 3;
+	napi_value argv[3];
+	napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+
+	if(argc != 2 && argc != 3) {
+		napi_throw_type_error(env, nullptr, "Wrong number of arguments");
+		return false;
+	}
+
+	napi_valuetype type;
+	options = nullptr;
+	if(argc == 3) {
+		napi_typeof(env, argv[1], &type);
+		if(type != napi_object) {
+			napi_throw_type_error(env, nullptr, "Options must be an object");
+			return false;
+		}
+		options = argv[1];
+	}
+
+	napi_typeof(env, argv[argc - 1], &type);
+	if(type != napi_function) {
+		napi_throw_type_error(env, nullptr, "Last argument must be callback");
+		return false;
+	}
+
+	first = argv[0];
+	callback = argv[argc - 1];
+	return true;
+}
+
+
+/***** Exports *****/
+
+napi_value nodeRunSimulation(napi_env env, napi_callback_info info) {
+	napi_value layout, options, callback, value;
+	if(!readArguments(env, info, layout, options, callback)) {
+		return nullptr;
+	}
+
+	std::shared_ptr<Reactor> reactor = reactorFromValue(env, layout);
+	if(!reactor) {
+		return nullptr;
+	}
+
+	std::unique_ptr<SimData> simData(new SimData(env));
 	simData->reactor = reactor;
-	uv_queue_work(uv_default_loop(), &simData->request, runSimWork, runSimAfter);
+	bool shareable = true;
+	if(!readLane(env, options, simData->lane)) {
+		return nullptr;
+	}
 
-	return scope.Close(Undefined());
+	if((value = getOption(env, options, "trace"))) {
+		shareable = false;
+		if(!traceCompiledIn) {
+			napi_throw_error(env, nullptr, "Trace support not compiled in (rebuild with reactorsim_trace=1)");
+			return nullptr;
+		}
+		napi_value traceOpts;
+		napi_coerce_to_object(env, value, &traceOpts);
+		int every = 1;
+		int capacity = Reactor::fuelTicks;
+		if((value = getOption(env, traceOpts, "every"))) every = (int)toInt64(env, value);
+		if((value = getOption(env, traceOpts, "capacity"))) capacity = (int)toInt64(env, value);
+		if((value = getOption(env, traceOpts, "file"))) {
+			simData->fileTrace.reset(new FileTraceSink(toUtf8(env, value), reactor->width, reactor->height, every));
+			if(!simData->fileTrace->good()) {
+				napi_throw_error(env, nullptr, "Could not open trace file");
+				return nullptr;
+			}
+			reactor->traceSink = simData->fileTrace.get();
+		} else {
+			simData->ringTrace.reset(new RingTraceSink(reactor->width * reactor->height, capacity, every));
+			reactor->traceSink = simData->ringTrace.get();
+		}
+	}
+
+	shareable = readSimOptions(env, options, simData.get()) && shareable;
+	if(!readInitialStateOption(env, options, simData.get(), shareable)) {
+		return nullptr;
+	}
+
+	if((value = getOption(env, options, "onFirstRun"))) {
+		shareable = false;
+		napi_valuetype type;
+		napi_typeof(env, value, &type);
+		if(type != napi_function) {
+			napi_throw_type_error(env, nullptr, "onFirstRun must be a function");
+			return nullptr;
+		}
+		napi_create_reference(env, value, 1, &simData->firstRunCallback);
+		napi_create_threadsafe_function(env, nullptr, nullptr, newString(env, "reactorsim-first-run"), 0, 1,
+			simData.get(), finalizeFirstRun, simData.get(), callFirstRun, &simData->firstRunFunction);
+		simData->simOptions.listener = simData.get();
+	}
+
+	return queueRequest(env, simData, shareable, callback);
+}
+
+static const uint64_t defaultSyncTickCap = 20000;
+
+// Runs the simulation on the calling thread and returns its results, unless it takes more than
+// syncTickCap ticks (default 20000; 0 for no cap).  Then it is queued like runSimulation(), the
+// callback receives its results, and the return value is the handle, with pending: true.  The
+// timeout still counts from this call.  trace and onFirstRun are not supported.
+napi_value nodeRunSimulationSync(napi_env env, napi_callback_info info) {
+	napi_value layout, options, callback, value;
+	if(!readArguments(env, info, layout, options, callback)) {
+		return nullptr;
+	}
+	if(getOption(env, options, "trace") || getOption(env, options, "onFirstRun")) {
+		napi_throw_type_error(env, nullptr, "runSimulationSync does not support trace or onFirstRun");
+		return nullptr;
+	}
+	std::shared_ptr<Reactor> reactor = reactorFromValue(env, layout);
+	if(!reactor) {
+		return nullptr;
+	}
+	Lane lane = LANE_INTERACTIVE;
+	if(!readLane(env, options, lane)) {
+		return nullptr;
+	}
+	uint64_t tickCap = defaultSyncTickCap;
+	if((value = getOption(env, options, "syncTickCap"))) {
+		tickCap = (uint64_t)toInt64(env, value);
+	}
+
+	// On a copy, so the reactor is untouched if the simulation has to be queued after all
+	std::unique_ptr<SimData> simData(new SimData(env));
+	simData->reactor.reset(new Reactor(*reactor));
+	bool shareable = readSimOptions(env, options, simData.get());
+	if(!readInitialStateOption(env, options, simData.get(), shareable)) {
+		return nullptr;
+	}
+	uint64_t tickBudget = simData->token.getTickBudget();
+	bool capped = tickCap && (!tickBudget || tickBudget > tickCap);
+	if(capped) {
+		simData->token.setTickBudget(tickCap);
+	}
+	simData->reactor->cancelToken = &simData->token;
+	// Only counted once it is known not to be redone on the thread pool
+	simData->simOptions.countOutcome = false;
+	simData->simResults = runSimulation(*simData->reactor, simData->simOptions);
+	if(!capped || simData->token.getReason() != CANCEL_TICK_BUDGET) {
+		countSimulationOutcome(simData->simResults);
+		statIncrement(STAT_SYNC_SIMULATIONS);
+		ResultsArena arena(1);
+		return simDataResultsToObject(env, simData.get(), arena);
+	}
+
+	statIncrement(STAT_SYNC_FALLBACKS);
+	std::unique_ptr<SimData> queued(new SimData(env));
+	queued->reactor = reactor;
+	queued->lane = lane;
+	shareable = readSimOptions(env, options, queued.get()) && !simData->initialState;
+	queued->token.copyDeadline(simData->token);
+	if(simData->initialState) setInitialState(queued.get(), *simData->initialState);
+	simData.reset();
+	napi_value handle = queueRequest(env, queued, shareable, callback);
+	setNamed(env, handle, "pending", newBool(env, true));
+	return handle;
+}
+
+// Queues a batch of simulations, one per reactor, calling back once with all of their results.
+// states, if not empty, holds the initial state of each.  sameLayout tells that every reactor
+// has the same layout, so that setup can be shared.  With results: 'columns', the callback gets one
+// Float64Array of SLOT_COUNT values per simulation instead of an array of results objects.
+napi_value queueBatch(napi_env env, std::vector<std::shared_ptr<Reactor>>& reactors, const std::vector<ReactorSnapshot>& states, bool sameLayout,
+	napi_value options, napi_value callback) {
+	uint32_t count = reactors.size();
+	Lane lane = LANE_BULK;
+	if(!readLane(env, options, lane)) {
+		return nullptr;
+	}
+	std::string resultsFile;
+	napi_value value;
+	if((value = getOption(env, options, "resultsFile"))) {
+		std::string error;
+		resultsFile = toUtf8(env, value);
+		if(!checkResultsFile(resultsFile, error)) {
+			napi_throw_error(env, nullptr, error.c_str());
+			return nullptr;
+		}
+	}
+
+	bool columns = false;
+	if((value = getOption(env, options, "results"))) {
+		std::string mode = toUtf8(env, value);
+		if(mode == "columns") {
+			columns = true;
+		} else if(mode != "objects") {
+			napi_throw_type_error(env, nullptr, "results must be 'objects' or 'columns'");
+			return nullptr;
+		}
+	}
+	// Neither fits in a slot
+	napi_value stress = getOption(env, options, "stress");
+	if(columns && ((stress && toBool(env, stress)) || getOption(env, options, "trace"))) {
+		napi_throw_type_error(env, nullptr, "results: 'columns' does not support stress or trace");
+		return nullptr;
+	}
+
+	napi_value results;
+	if(columns) {
+		void* data;
+		results = newTypedArray(env, napi_float64_array, sizeof(double), (size_t)count * SLOT_COUNT, &data);
+	} else {
+		napi_create_array_with_length(env, count, &results);
+	}
+	BatchData* batch = new BatchData();
+	batch->columns = columns;
+	napi_create_reference(env, callback, 1, &batch->callback);
+	napi_create_reference(env, results, 1, &batch->results);
+	batch->remaining = count;
+	if(!resultsFile.empty()) {
+		batch->resultsFile = resultsFile;
+		batch->reactors = reactors;
+		batch->fileResults.resize(count);
+	}
+	napi_value handle = newJobHandle(env, batch);
+	if(count == 0) {
+		// Called back like any other batch, after this returns
+		getAddonData(env)->emptyBatches.push_back(batch);
+		startDelivery(env);
+		return handle;
+	}
 
-	//SimulationResults simResults = runSimulation(reactor);
+	std::vector<SimData*> newSims;
+	int sharedEstimate = -1;
+	for(uint32_t i = 0; i < count; ++i) {
+		SimData* simData = new SimData(env);
+		simData->reactor = reactors[i];
+		simData->lane = lane;
+		bool shareable = readSimOptions(env, options, simData);
+		if(!states.empty()) {
+			setInitialState(simData, states[i]);
+			shareable = false;
+		}
+		SimData* existing = findCoalescable(env, simData, shareable);
+		if(existing) {
+			delete simData;
+			simData = existing;
+			raiseLane(env, simData, lane);
+		} else {
+			registerInFlight(env, simData);
+			// The estimate only depends on the layout
+			if(!sameLayout || sharedEstimate < 0) {
+				sharedEstimate = estimateSimulationTicks(*simData->reactor, simData->simOptions);
+			}
+			simData->predictedTicks = sharedEstimate;
+			newSims.push_back(simData);
+		}
+		Subscriber subscriber;
+		subscriber.batch = batch;
+		subscriber.batchIndex = i;
+		BatchItem item = { simData, simData->subscribe(subscriber) };
+		batch->items.push_back(item);
+	}
+	std::stable_sort(newSims.begin(), newSims.end(), [](SimData* a, SimData* b) { return a->predictedTicks > b->predictedTicks; });
+	for(SimData* simData : newSims) {
+		queueSimData(env, simData);
+	}
 
-	//return scope.Close(simResultsToV8Object(simResults));
+	return handle;
 }
 
-void nodeInit(Handle<Object> exports) {
-	exports->Set(String::NewSymbol("runSimulation"), FunctionTemplate::New(nodeRunSimulation)->GetFunction());
+// Queues every layout as its own job, so they run in parallel on the thread pool, and calls back
+// once with the results in layout order.  Options apply to each simulation separately.  Duplicate
+// layouts, within the batch or already in flight, share one simulation.  Jobs are queued in order
+// of estimated cost, most expensive first, so that a long simulation started last does not keep
+// the batch waiting while the rest of the pool sits idle.  With resultsFile, the results are also
+// appended to that file as one block (see resultsfile.hpp), unless the batch is cancelled.
+napi_value nodeRunSimulationBatch(napi_env env, napi_callback_info info) {
+	napi_value layouts, options, callback;
+	if(!readArguments(env, info, layouts, options, callback)) {
+		return nullptr;
+	}
+	bool isArray = false;
+	napi_valuetype type;
+	napi_is_array(env, layouts, &isArray);
+	napi_typeof(env, layouts, &type);
+	std::vector<std::shared_ptr<Reactor>> reactors;
+	if(isArray) {
+		uint32_t len = 0;
+		napi_get_array_length(env, layouts, &len);
+		for(uint32_t i = 0; i < len; ++i) {
+			napi_value layout;
+			napi_get_element(env, layouts, i, &layout);
+			reactors.push_back(reactorFromValue(env, layout));
+			if(!reactors.back()) {
+				return nullptr;
+			}
+		}
+	} else if(type == napi_object) {
+		if(!reactorsFromPacked(env, layouts, reactors)) {
+			return nullptr;
+		}
+	} else {
+		napi_throw_type_error(env, nullptr, "Layouts must be an array or packed layouts");
+		return nullptr;
+	}
+
+	// The same initial state for every layout
+	std::vector<ReactorSnapshot> states;
+	napi_value value;
+	if((value = getOption(env, options, "initialState"))) {
+		states.resize(reactors.size());
+		for(size_t i = 0; i < reactors.size(); ++i) {
+			if(!readInitialState(env, value, *reactors[i], states[i])) {
+				return nullptr;
+			}
+		}
+	}
+	return queueBatch(env, reactors, states, false, options, callback);
 }
 
-NODE_MODULE(nodereactorsim, nodeInit)
+// Simulates one layout from each of an array of initial states, like runSimulationBatch() with
+// the layout parsed once: runSimulationStates(layout, states, [options], callback)
+napi_value nodeRunSimulationStates(napi_env env, napi_callback_info info) {
+	size_t argc = 4;
+	napi_value argv[4];
+	napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+	if(argc != 3 && argc != 4) {
+		napi_throw_type_error(env, nullptr, "Wrong number of arguments");
+		return nullptr;
+	}
+	napi_valuetype type;
+	napi_value options = nullptr;
+	if(argc == 4) {
+		napi_typeof(env, argv[2], &type);
+		if(type != napi_object) {
+			napi_throw_type_error(env, nullptr, "Options must be an object");
+			return nullptr;
+		}
+		options = argv[2];
+	}
+	napi_value callback = argv[argc - 1];
+	napi_typeof(env, callback, &type);
+	if(type != napi_function) {
+		napi_throw_type_error(env, nullptr, "Last argument must be callback");
+		return nullptr;
+	}
+	bool isArray = false;
+	napi_is_array(env, argv[1], &isArray);
+	if(!isArray) {
+		napi_throw_type_error(env, nullptr, "Initial states must be an array");
+		return nullptr;
+	}
+	std::shared_ptr<Reactor> reactor = reactorFromValue(env, argv[0]);
+	if(!reactor) {
+		return nullptr;
+	}
+
+	uint32_t count = 0;
+	napi_get_array_length(env, argv[1], &count);
+	std::vector<ReactorSnapshot> states(count);
+	for(uint32_t i = 0; i < count; ++i) {
+		napi_value state;
+		napi_get_element(env, argv[1], i, &state);
+		if(!readInitialState(env, state, *reactor, states[i])) {
+			return nullptr;
+		}
+	}
+	// Copies of the parsed reactor, since each simulation runs on its own
+	std::vector<std::shared_ptr<Reactor>> reactors;
+	reactors.reserve(count);
+	for(uint32_t i = 0; i < count; ++i) {
+		reactors.push_back(i ? std::shared_ptr<Reactor>(new Reactor(*reactor)) : reactor);
+	}
+	return queueBatch(env, reactors, states, true, options, callback);
+}
+
+struct PlanData : public CancellableJob {
+	napi_env env = nullptr;
+	napi_async_work work = nullptr;
+	napi_ref callback = nullptr;
+	CancellationToken token;
+	std::shared_ptr<Reactor> reactor;
+	DutyCycleOptions options;
+	DutyCycleResults results;
+
+	// Stops the search if it is running, or takes it off the queue if it has not started
+	void cancel() {
+		token.cancel();
+		napi_cancel_async_work(env, work);
+	}
+};
+
+void planExecute(napi_env env, void* data) {
+	PlanData* planData = static_cast<PlanData*>(data);
+	planData->results = planDutyCycle(*planData->reactor, planData->options);
+}
+
+void planComplete(napi_env env, napi_status status, void* data) {
+	PlanData* planData = static_cast<PlanData*>(data);
+	DutyCycleResults& results = planData->results;
+	if(status == napi_cancelled) {
+		// Cancelled before it started
+		statIncrement(STAT_CANCELLED_QUEUED_JOBS);
+		results.incomplete = true;
+	}
+	napi_value obj = newObject(env);
+	RES_BOOL(found)
+	RES_INT(onTicks)
+	RES_INT(offTicks)
+	RES_INT(euPerTick)
+	RES_NUMBER(overallEUPerTick)
+	RES_INT(schedulesTested)
+	RES_NUMBER(ticksSimulated)
+	RES_BOOL(incomplete)
+	if(results.incomplete) {
+		setNamed(env, obj, "incompleteReason", newString(env, cancelReasonNames[planData->token.getReason()]));
+	}
+	unregisterJob(env, planData);
+	callCallback(env, planData->callback, obj);
+	napi_delete_reference(env, planData->callback);
+	napi_delete_async_work(env, planData->work);
+	delete planData;
+}
+
+// Searches for the on/off schedule with the highest overall EU/t that keeps the reactor safe
+// indefinitely; see dutycycle.hpp.  Takes the same layout argument as runSimulation(), the
+// DutyCycleOptions, and maxTicks and timeout, which cover the whole search.
+napi_value nodePlanDutyCycle(napi_env env, napi_callback_info info) {
+	napi_value layout, options, callback, value;
+	if(!readArguments(env, info, layout, options, callback)) {
+		return nullptr;
+	}
+	std::shared_ptr<Reactor> reactor = reactorFromValue(env, layout);
+	if(!reactor) {
+		return nullptr;
+	}
+
+	PlanData* planData = new PlanData();
+	planData->env = env;
+	planData->reactor = reactor;
+	reactor->cancelToken = &planData->token;
+	readBudgetOptions(env, options, planData->token);
+	if((value = getOption(env, options, "granularity"))) planData->options.granularity = (int)toInt64(env, value);
+	if((value = getOption(env, options, "maxOnTicks"))) planData->options.maxOnTicks = (int)toInt64(env, value);
+	if((value = getOption(env, options, "maxOffTicks"))) planData->options.maxOffTicks = (int)toInt64(env, value);
+	if((value = getOption(env, options, "maxScheduleTicks"))) planData->options.maxScheduleTicks = (int)toInt64(env, value);
+
+	napi_create_reference(env, callback, 1, &planData->callback);
+	napi_create_async_work(env, nullptr, newString(env, "reactorsim-duty-cycle"), planExecute, planComplete, planData, &planData->work);
+	napi_queue_async_work(env, planData->work);
+	return newJobHandle(env, planData);
+}
+
+// Reads every grid of a file into packed layouts: { count, widths, types, lines, errors }.  widths
+// and types are Uint8Arrays that runSimulationBatch() accepts as they are; lines gives the line of
+// each layout's first row.  Invalid grids are skipped and listed in errors as { line, column,
+// message }, up to maxErrors (default 1000); numErrors counts all of them.
+napi_value nodeLoadGridFile(napi_env env, napi_callback_info info) {
+	size_t argc = 2;
+	napi_value argv[2];
+	napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+	if(argc < 1) {
+		napi_throw_type_error(env, nullptr, "Wrong number of arguments");
+		return nullptr;
+	}
+	size_t maxErrors = 1000;
+	napi_value value;
+	if(argc > 1 && (value = getOption(env, argv[1], "maxErrors"))) {
+		maxErrors = (size_t)toInt64(env, value);
+	}
+
+	std::string filename = toUtf8(env, argv[0]);
+	PackedLayouts layouts;
+	std::vector<GridParseError> errors;
+	size_t numErrors;
+	if(!loadGridFile(filename, layouts, errors, numErrors, maxErrors)) {
+		napi_throw_error(env, nullptr, ("Could not read grid file " + filename).c_str());
+		return nullptr;
+	}
+
+	napi_value obj = newObject(env);
+	void* data;
+	setNamed(env, obj, "count", newNumber(env, layouts.size()));
+	setNamed(env, obj, "widths", newTypedArray(env, napi_uint8_array, 1, layouts.widths.size(), &data));
+	if(!layouts.widths.empty()) memcpy(data, &layouts.widths[0], layouts.widths.size());
+	setNamed(env, obj, "types", newTypedArray(env, napi_uint8_array, 1, layouts.types.size(), &data));
+	if(!layouts.types.empty()) memcpy(data, &layouts.types[0], layouts.types.size());
+	setNamed(env, obj, "lines", newTypedArray(env, napi_uint32_array, 4, layouts.lines.size(), &data));
+	if(!layouts.lines.empty()) memcpy(data, &layouts.lines[0], layouts.lines.size() * 4);
+
+	napi_value errorList;
+	napi_create_array_with_length(env, errors.size(), &errorList);
+	for(size_t i = 0; i < errors.size(); ++i) {
+		napi_value err = newObject(env);
+		setNamed(env, err, "line", newNumber(env, errors[i].line));
+		setNamed(env, err, "column", newNumber(env, errors[i].column));
+		setNamed(env, err, "message", newString(env, errors[i].message.c_str()));
+		napi_set_element(env, errorList, i, err);
+	}
+	setNamed(env, obj, "errors", errorList);
+	setNamed(env, obj, "numErrors", newNumber(env, numErrors));
+	return obj;
+}
+
+#ifndef _WIN32
+void unmapFile(napi_env env, void* data, void* hint) {
+	munmap(data, (size_t)(uintptr_t)hint);
+}
+#endif
+
+// Returns the contents of a results file as an ArrayBuffer, memory-mapped where supported, for
+// readResultsFile() in resultsfile.js to create column views on
+napi_value nodeMapResultsFile(napi_env env, napi_callback_info info) {
+	size_t argc = 1;
+	napi_value arg;
+	napi_get_cb_info(env, info, &argc, &arg, nullptr, nullptr);
+	if(argc < 1) {
+		napi_throw_type_error(env, nullptr, "Filename required");
+		return nullptr;
+	}
+	std::string filename = toUtf8(env, arg);
+	napi_value buffer;
+#ifdef _WIN32
+	std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+	if(!ifs.good()) {
+		napi_throw_error(env, nullptr, ("Could not read results file " + filename).c_str());
+		return nullptr;
+	}
+	std::stringstream contents;
+	contents << ifs.rdbuf();
+	std::string data = contents.str();
+	void* bufferData;
+	napi_create_arraybuffer(env, data.size(), &bufferData, &buffer);
+	if(!data.empty()) memcpy(bufferData, data.data(), data.size());
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) != 0) {
+		if(fd != -1) close(fd);
+		napi_throw_error(env, nullptr, ("Could not read results file " + filename).c_str());
+		return nullptr;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		void* bufferData;
+		napi_create_arraybuffer(env, 0, &bufferData, &buffer);
+		return buffer;
+	}
+	// Copy-on-write, so that writing to a view does not fault or change the file
+	void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		napi_throw_error(env, nullptr, ("Could not map results file " + filename).c_str());
+		return nullptr;
+	}
+	// Unmapped once every view on it has been collected
+	napi_create_external_arraybuffer(env, data, st.st_size, unmapFile, (void*)(uintptr_t)st.st_size, &buffer);
+#endif
+	return buffer;
+}
+
+struct CompactData {
+	napi_async_work work = nullptr;
+	napi_ref callback = nullptr;
+	std::string filename;
+	std::string error;
+};
+
+void compactExecute(napi_env env, void* data) {
+	CompactData* compactData = static_cast<CompactData*>(data);
+	compactResultsFile(compactData->filename, compactData->error);
+}
+
+void compactComplete(napi_env env, napi_status status, void* data) {
+	CompactData* compactData = static_cast<CompactData*>(data);
+	if(compactData->error.empty()) {
+		napi_value undefined;
+		napi_get_undefined(env, &undefined);
+		callCallback(env, compactData->callback, undefined);
+	} else {
+		callCallbackError(env, compactData->callback, compactData->error);
+	}
+	napi_delete_reference(env, compactData->callback);
+	napi_delete_async_work(env, compactData->work);
+	delete compactData;
+}
+
+// Rewrites a results file into a single block on the thread pool; see compactResultsFile() in
+// resultsfile.hpp.  callback(error).
+napi_value nodeCompactResultsFile(napi_env env, napi_callback_info info) {
+	size_t argc = 2;
+	napi_value argv[2];
+	napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+	napi_valuetype type = napi_undefined;
+	if(argc == 2) napi_typeof(env, argv[1], &type);
+	if(type != napi_function) {
+		napi_throw_type_error(env, nullptr, "Last argument must be callback");
+		return nullptr;
+	}
+	CompactData* compactData = new CompactData();
+	compactData->filename = toUtf8(env, argv[0]);
+	napi_create_reference(env, argv[1], 1, &compactData->callback);
+	napi_create_async_work(env, nullptr, newString(env, "reactorsim-results-file"), compactExecute, compactComplete, compactData, &compactData->work);
+	napi_queue_async_work(env, compactData->work);
+	return nullptr;
+}
+
+static const char* branchNames[] = { "noFuel", "componentFailed", "meltdown", "coldAfterRun", "rerun" };
+static const char* statPhaseNames[] = { "firstRun", "cooldown", "runUntilFinish", "rerun" };
+
+// Stats are process-wide, covering the simulations of every thread that loaded the addon
+napi_value nodeGetStats(napi_env env, napi_callback_info info) {
+	StatsSnapshot snap = collectStats();
+	napi_value obj = newObject(env);
+
+	setNamed(env, obj, "simulations", newNumber(env, snap.values[STAT_SIMULATIONS]));
+
+	napi_value runUntil = newObject(env);
+	for(int i = 0; i < numStopReasons; ++i) {
+		napi_value reason = newObject(env);
+		setNamed(env, reason, "calls", newNumber(env, snap.values[STAT_RUN_UNTIL_CALLS + i]));
+		setNamed(env, reason, "ticks", newNumber(env, snap.values[STAT_TICKS + i]));
+		setNamed(env, runUntil, stopReasonNames[i], reason);
+	}
+	setNamed(env, obj, "runUntil", runUntil);
+
+	napi_value branches = newObject(env);
+	for(int i = 0; i < BRANCH_COUNT; ++i) {
+		setNamed(env, branches, branchNames[i], newNumber(env, snap.values[STAT_BRANCH + i]));
+	}
+	setNamed(env, obj, "branches", branches);
+
+	napi_value marks;
+	napi_create_array_with_length(env, numMarks, &marks);
+	for(int i = 0; i < numMarks; ++i) {
+		napi_set_element(env, marks, i, newNumber(env, snap.values[STAT_MARK + i]));
+	}
+	setNamed(env, obj, "marks", marks);
+
+	napi_value phaseMs = newObject(env);
+	for(int i = 0; i < STAT_PHASE_COUNT; ++i) {
+		setNamed(env, phaseMs, statPhaseNames[i], newNumber(env, snap.values[STAT_PHASE_NANOS + i] / 1e6));
+	}
+	setNamed(env, obj, "phaseMs", phaseMs);
+
+	setNamed(env, obj, "timedOutCooldowns", newNumber(env, snap.values[STAT_TIMED_OUT_COOLDOWNS]));
+	setNamed(env, obj, "reactorCopies", newNumber(env, snap.values[STAT_REACTOR_COPIES]));
+	setNamed(env, obj, "componentAllocations", newNumber(env, snap.values[STAT_COMPONENT_ALLOCATIONS]));
+	setNamed(env, obj, "incompleteSimulations", newNumber(env, snap.values[STAT_INCOMPLETE_SIMULATIONS]));
+	setNamed(env, obj, "rejectedSimulations", newNumber(env, snap.values[STAT_REJECTED_SIMULATIONS]));
+	setNamed(env, obj, "coalescedSimulations", newNumber(env, snap.values[STAT_COALESCED_SIMULATIONS]));
+
+	napi_value sync = newObject(env);
+	setNamed(env, sync, "inline", newNumber(env, snap.values[STAT_SYNC_SIMULATIONS]));
+	setNamed(env, sync, "fallbacks", newNumber(env, snap.values[STAT_SYNC_FALLBACKS]));
+	setNamed(env, obj, "sync", sync);
+
+	napi_value cycles = newObject(env);
+	setNamed(env, cycles, "simulated", newNumber(env, snap.values[STAT_CYCLES_SIMULATED]));
+	setNamed(env, cycles, "skipped", newNumber(env, snap.values[STAT_CYCLES_SKIPPED]));
+	setNamed(env, obj, "exactCycles", cycles);
+
+	napi_value queue = newObject(env);
+	setNamed(env, queue, "jobs", newNumber(env, snap.values[STAT_QUEUED_JOBS]));
+	setNamed(env, queue, "totalWaitMs", newNumber(env, snap.values[STAT_QUEUE_WAIT_NANOS] / 1e6));
+	setNamed(env, queue, "cancelled", newNumber(env, snap.values[STAT_CANCELLED_QUEUED_JOBS]));
+	setNamed(env, obj, "queue", queue);
+
+	// waiting and dispatched are for this thread's simulations only
+	AddonData* addonData = getAddonData(env);
+	napi_value lanes = newObject(env);
+	for(int i = 0; i < numLanes; ++i) {
+		napi_value lane = newObject(env);
+		setNamed(env, lane, "jobs", newNumber(env, snap.values[STAT_LANE_JOBS + i]));
+		setNamed(env, lane, "totalWaitMs", newNumber(env, snap.values[STAT_LANE_WAIT_NANOS + i] / 1e6));
+		setNamed(env, lane, "waiting", newNumber(env, addonData->waiting[i].size()));
+		setNamed(env, lane, "dispatched", newNumber(env, addonData->dispatched[i]));
+		setNamed(env, lanes, laneNames[i], lane);
+	}
+	setNamed(env, obj, "lanes", lanes);
+
+	napi_value costModel = newObject(env);
+	setNamed(env, costModel, "simulations", newNumber(env, snap.values[STAT_ESTIMATED_SIMULATIONS]));
+	setNamed(env, costModel, "predictedTicks", newNumber(env, snap.values[STAT_PREDICTED_TICKS]));
+	setNamed(env, costModel, "actualTicks", newNumber(env, snap.values[STAT_ESTIMATED_ACTUAL_TICKS]));
+	napi_value ratios;
+	napi_create_array_with_length(env, numCostRatioBuckets, &ratios);
+	for(int i = 0; i < numCostRatioBuckets; ++i) {
+		napi_set_element(env, ratios, i, newNumber(env, snap.values[STAT_COST_RATIO + i]));
+	}
+	setNamed(env, costModel, "log2Ratios", ratios);
+	setNamed(env, obj, "costModel", costModel);
+
+	napi_value delivery = newObject(env);
+	setNamed(env, delivery, "flushes", newNumber(env, snap.values[STAT_DELIVERY_FLUSHES]));
+	setNamed(env, delivery, "simulations", newNumber(env, snap.values[STAT_DELIVERED_SIMULATIONS]));
+	setNamed(env, obj, "delivery", delivery);
+
+	return obj;
+}
+
+// Sets the thread pool size the lanes assume and the number of threads kept free of bulk
+// simulations, and returns both
+napi_value nodeConfigureLanes(napi_env env, napi_callback_info info) {
+	size_t argc = 1;
+	napi_value options;
+	napi_get_cb_info(env, info, &argc, &options, nullptr, nullptr);
+	AddonData* addonData = getAddonData(env);
+	napi_value value;
+	if(argc >= 1) {
+		if((value = getOption(env, options, "threads")) && toInt64(env, value) > 0) {
+			addonData->threads = (uint32_t)toInt64(env, value);
+		}
+		if((value = getOption(env, options, "reservedThreads")) && toInt64(env, value) >= 0) {
+			addonData->reservedThreads = (uint32_t)toInt64(env, value);
+		}
+		dispatchWaiting(env);
+	}
+	napi_value obj = newObject(env);
+	setNamed(env, obj, "threads", newNumber(env, addonData->threads));
+	setNamed(env, obj, "reservedThreads", newNumber(env, addonData->reservedThreads));
+	return obj;
+}
+
+static const char* transformNames[] = { "identity", "mirrorX", "mirrorY", "rotate180", "transpose", "antiTranspose", "rotate90", "rotate270" };
+
+napi_value typesToCodes(napi_env env, const std::vector<ComponentType>& types) {
+	napi_value arr;
+	napi_create_array_with_length(env, types.size(), &arr);
+	for(size_t i = 0; i < types.size(); ++i) {
+		napi_set_element(env, arr, i, newString(env, getComponentTypeAbbr(types[i]).c_str()));
+	}
+	return arr;
+}
+
+// Returns { layout, transform, transforms, equivalents } for an array of component codes: the
+// canonical layout of its equivalence class, the name of a transform that maps the layout onto it,
+// the names of the transforms proven to leave the layout's results unchanged, and every layout of
+// the class, canonical first
+napi_value nodeCanonicalizeLayout(napi_env env, napi_callback_info info) {
+	size_t argc = 1;
+	napi_value arg;
+	napi_get_cb_info(env, info, &argc, &arg, nullptr, nullptr);
+	if(argc < 1) {
+		napi_throw_type_error(env, nullptr, "Layout required");
+		return nullptr;
+	}
+	std::shared_ptr<Reactor> reactor = reactorFromValue(env, arg);
+	if(!reactor) {
+		return nullptr;
+	}
+	std::vector<ComponentType> types = reactor->getComponentTypes();
+	std::vector<std::vector<ComponentType>> equivalents = getEquivalentLayouts(types, reactor->width, reactor->height);
+
+	napi_value obj = newObject(env);
+	napi_value transforms, equivalentsArray;
+	setNamed(env, obj, "layout", typesToCodes(env, equivalents.front()));
+	for(int t = TRANSFORM_IDENTITY; t < TRANSFORM_COUNT; ++t) {
+		if(isTransformApplicable((LayoutTransform)t, reactor->width, reactor->height) && transformLayout(types, reactor->width, reactor->height, (LayoutTransform)t) == equivalents.front()) {
+			setNamed(env, obj, "transform", newString(env, transformNames[t]));
+			break;
+		}
+	}
+	napi_create_array(env, &transforms);
+	uint32_t numTransforms = 0;
+	for(int t = TRANSFORM_IDENTITY; t < TRANSFORM_COUNT; ++t) {
+		if(isEquivalentUnder(types, reactor->width, reactor->height, (LayoutTransform)t)) {
+			napi_set_element(env, transforms, numTransforms++, newString(env, transformNames[t]));
+		}
+	}
+	setNamed(env, obj, "transforms", transforms);
+	napi_create_array_with_length(env, equivalents.size(), &equivalentsArray);
+	for(size_t i = 0; i < equivalents.size(); ++i) {
+		napi_set_element(env, equivalentsArray, i, typesToCodes(env, equivalents[i]));
+	}
+	setNamed(env, obj, "equivalents", equivalentsArray);
+	return obj;
+}
+
+// Sets how many milliseconds completed simulations may wait so that they are delivered together,
+// and returns it
+napi_value nodeConfigureDelivery(napi_env env, napi_callback_info info) {
+	size_t argc = 1;
+	napi_value options;
+	napi_get_cb_info(env, info, &argc, &options, nullptr, nullptr);
+	AddonData* addonData = getAddonData(env);
+	napi_value value;
+	if(argc >= 1 && (value = getOption(env, options, "maxLatency")) && toInt64(env, value) >= 0) {
+		addonData->maxDeliveryLatency = (uint32_t)std::min(toInt64(env, value), (int64_t)60000);
+	}
+	napi_value obj = newObject(env);
+	setNamed(env, obj, "maxLatency", newNumber(env, addonData->maxDeliveryLatency));
+	return obj;
+}
+
+// Registers the function that builds the results objects simulations call back with from now on,
+// called with (values, index); see simresults.js
+napi_value nodeSetResultsFactory(napi_env env, napi_callback_info info) {
+	size_t argc = 1;
+	napi_value resultsFactory;
+	napi_get_cb_info(env, info, &argc, &resultsFactory, nullptr, nullptr);
+	napi_valuetype type = napi_undefined;
+	if(argc >= 1) napi_typeof(env, resultsFactory, &type);
+	if(type != napi_function) {
+		napi_throw_type_error(env, nullptr, "Results factory must be a function");
+		return nullptr;
+	}
+	AddonData* addonData = getAddonData(env);
+	if(addonData->resultsFactory) napi_delete_reference(env, addonData->resultsFactory);
+	napi_create_reference(env, resultsFactory, 1, &addonData->resultsFactory);
+	return getUndefined(env);
+}
+
+napi_value nodeResetStats(napi_env env, napi_callback_info info) {
+	resetStats();
+	return getUndefined(env);
+}
+
+NAPI_MODULE_INIT() {
+	napi_set_instance_data(env, new AddonData(), deleteAddonData, nullptr);
+
+	napi_property_descriptor properties[] = {
+		{ "runSimulation", nullptr, nodeRunSimulation, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "runSimulationSync", nullptr, nodeRunSimulationSync, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "runSimulationBatch", nullptr, nodeRunSimulationBatch, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "runSimulationStates", nullptr, nodeRunSimulationStates, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "planDutyCycle", nullptr, nodePlanDutyCycle, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "loadGridFile", nullptr, nodeLoadGridFile, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "mapResultsFile", nullptr, nodeMapResultsFile, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "compactResultsFile", nullptr, nodeCompactResultsFile, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "canonicalizeLayout", nullptr, nodeCanonicalizeLayout, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "configureLanes", nullptr, nodeConfigureLanes, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "configureDelivery", nullptr, nodeConfigureDelivery, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "setResultsFactory", nullptr, nodeSetResultsFactory, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "getStats", nullptr, nodeGetStats, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "resetStats", nullptr, nodeResetStats, nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+		{ "traceCompiledIn", nullptr, nullptr, nullptr, nullptr, newBool(env, traceCompiledIn), napi_enumerable, nullptr },
+		{ "usdtCompiledIn", nullptr, nullptr, nullptr, nullptr, newBool(env, usdtCompiledIn), napi_enumerable, nullptr }
+	};
+	napi_define_properties(env, exports, sizeof(properties) / sizeof(properties[0]), properties);
+	return exports;
+}
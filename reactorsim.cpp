@@ -1,7 +1,15 @@
 #include "reactorsim.hpp"
 #include <iostream>
+#include <algorithm>
 #include <typeinfo>
+#include <unordered_map>
 #include "gridio.hpp"
+#include "simstats.hpp"
+#include "simprobes.hpp"
+
+#ifdef REACTORSIM_USDT
+SIM_PROBES(SIM_PROBE_SEMAPHORE_DEFINITION)
+#endif
 
 namespace reactorsim {
 
@@ -71,6 +79,7 @@ shared_ptr<ReactorComponent> ReactorComponent::create(ComponentType type, Reacto
 
 		default: ptr = 0; break;
 	}
+	if(ptr) statIncrement(STAT_COMPONENT_ALLOCATIONS);
 	return shared_ptr<ReactorComponent>(ptr);
 }
 
@@ -93,6 +102,11 @@ Reactor::Reactor(int extraChambers) {
 	width = 3 + extraChambers;
 	numExtraChambers = extraChambers;
 	ignoreComponentDestroyed = false;
+	producing = true;
+	fuelEndTick = fuelTicks;
+	traceSink = 0;
+	tickObserver = 0;
+	cancelToken = 0;
 	components.reserve(width * height);
 	for(int i = 0; i < width * height; i++) {
 		components.push_back(shared_ptr<ReactorComponent>());
@@ -109,14 +123,21 @@ Reactor::Reactor(const Reactor& other) {
 	pendingSimState = other.pendingSimState;
 	maxHeat = other.maxHeat;
 	ignoreComponentDestroyed = other.ignoreComponentDestroyed;
+	producing = other.producing;
+	fuelEndTick = other.fuelEndTick;
+	traceSink = other.traceSink;
+	tickObserver = 0;
+	cancelToken = other.cancelToken;
 	components.reserve(width * height);
 	for(std::vector<shared_ptr<ReactorComponent>>::const_iterator itr = other.components.cbegin(); itr != other.components.cend(); ++itr) {
 		shared_ptr<ReactorComponent> newComponent(itr->get() ? itr->get()->clone() : 0);
 		if(newComponent.get()) {
 			newComponent->reactor = this;
+			statIncrement(STAT_COMPONENT_ALLOCATIONS);
 		}
 		components.push_back(newComponent);
 	}
+	statIncrement(STAT_REACTOR_COPIES);
 }
 
 std::vector<ComponentType> Reactor::getComponentTypes() {
@@ -203,12 +224,22 @@ int Reactor::getMaxHeat() {
 }
 
 void Reactor::componentDestroyed(int x, int y) {
+	SIM_PROBE3(component__destroyed, y * width + x, get(x, y) ? (int)get(x, y)->type : 0, pendingSimState.curTick + 1);
 	if(!ignoreComponentDestroyed) {
 		pendingSimState.componentFailed = true;
+		if(traceCompiledIn && traceSink) {
+			traceSink->recordEvent(*this, y * width + x, TRACE_EVENT_COMPONENT_DESTROYED);
+		}
 	}
 }
 
 void Reactor::heatCapacityExceeded() {
+	if(!pendingSimState.meltdown) {
+		SIM_PROBE2(meltdown, pendingSimState.curTick + 1, pendingSimState.reactorHeat);
+		if(traceCompiledIn && traceSink) {
+			traceSink->recordEvent(*this, -1, TRACE_EVENT_MELTDOWN);
+		}
+	}
 	pendingSimState.meltdown = true;
 }
 
@@ -267,8 +298,16 @@ int Reactor::getTotalCost() {
 }
 
 // Returns before committing the tick that caused the stop condition
-RunUntilStopReason Reactor::runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed) {
-	int maxTicks = timeoutTicks;
+RunUntilStopReason Reactor::runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed, int maxTicks) {
+	int startTick = pendingSimState.curTick;
+	RunUntilStopReason reason = runTicksUntil(stopOnMeltdown, stopOnFuelUsed, stopOnCooledDown, stopOnComponentFailed, maxTicks);
+	statIncrement(STAT_RUN_UNTIL_CALLS + reason);
+	statAdd(STAT_TICKS + reason, pendingSimState.curTick - startTick);
+	SIM_PROBE2(rununtil, (int)reason, pendingSimState.curTick - startTick);
+	return reason;
+}
+
+RunUntilStopReason Reactor::runTicksUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed, int maxTicks) {
 	bool firstIteration = true;
 	int lastTotalHeat = -1;
 	int noHeatLossCheckInterval = 8;
@@ -279,7 +318,7 @@ RunUntilStopReason Reactor::runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, b
 		if(pendingSimState.componentFailed && stopOnComponentFailed) {
 			return STOPPED_ON_COMPONENT_FAILED;
 		}
-		if(pendingSimState.curTick >= fuelTicks && stopOnFuelUsed) {
+		if(pendingSimState.curTick >= fuelEndTick && stopOnFuelUsed) {
 			return STOPPED_ON_FUEL_USED;
 		}
 		if(pendingSimState.totalHeat <= 0 && stopOnCooledDown) {
@@ -308,14 +347,24 @@ RunUntilStopReason Reactor::runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, b
 		} else {
 			commit();
 		}
+		if(cancelToken && !cancelToken->consumeTick()) {
+			return STOPPED_ON_CANCELLED;
+		}
 		runTick();
 		pendingSimState.curTick++;
+		if(traceCompiledIn && traceSink && traceSink->wantsTick(pendingSimState.curTick)) {
+			traceSink->recordTick(*this);
+		}
+		if(tickObserver) {
+			tickObserver->onTick(*this);
+		}
 	}
 }
 
-void Reactor::initializeSimulation() {
+void Reactor::initializeSimulation(const ReactorSnapshot* initialState) {
 	// Reset simulation state
 	curSimState = pendingSimState = SimulationState();
+	fuelEndTick = fuelTicks;
 
 	// Initialize all components
 	for(std::vector<shared_ptr<ReactorComponent>>::iterator itr = components.begin(); itr != components.end(); ++itr) {
@@ -323,6 +372,10 @@ void Reactor::initializeSimulation() {
 			(*itr)->init();
 		}
 	}
+	if(initialState) {
+		restoreSnapshot(*initialState);
+		fuelEndTick = getFuelTicksLeft();
+	}
 
 	// Calculate total number of uranium cells, and check for single use coolants
 	numUraniumCells = 0;
@@ -347,6 +400,63 @@ void Reactor::resetUsage() {
 	curSimState.curTick = 0;
 	curSimState.euGenerated = 0;
 	pendingSimState = curSimState;
+	fuelEndTick = fuelTicks;
+}
+
+// Ticks until the least used fuel cell is used up
+int Reactor::getFuelTicksLeft() {
+	int minUsage = -1;
+	for(auto& component : components) {
+		ComponentType type = component.get() ? component->type : COMPONENT_NONE;
+		if(type == URANIUM_CELL || type == DUAL_URANIUM_CELL || type == QUAD_URANIUM_CELL) {
+			int usage = component->getUsage();
+			if(minUsage == -1 || usage < minUsage) minUsage = usage;
+		}
+	}
+	return minUsage == -1 ? 0 : std::max(fuelTicks - minUsage, 0);
+}
+
+static void setTracePhase(Reactor& reactor, TracePhase phase) {
+	if(traceCompiledIn && reactor.traceSink) {
+		reactor.traceSink->phase = phase;
+	}
+}
+
+ReactorSnapshot Reactor::captureSnapshot() {
+	ReactorSnapshot snapshot;
+	snapshot.reactorHeat = pendingSimState.reactorHeat;
+	snapshot.cellHeat.reserve(components.size());
+	snapshot.cellUsage.reserve(components.size());
+	snapshot.cellPresent.reserve(components.size());
+	for(auto& component : components) {
+		bool present = component.get() && !component->isDestroyed();
+		snapshot.cellPresent.push_back(present);
+		snapshot.cellHeat.push_back(present ? component->getCurrentHeat() : 0);
+		snapshot.cellUsage.push_back(present ? component->getUsage() : 0);
+	}
+	return snapshot;
+}
+
+// Restores heat and usage, and removes components that are absent in the snapshot
+void Reactor::restoreSnapshot(const ReactorSnapshot& snapshot) {
+	curSimState.reactorHeat = pendingSimState.reactorHeat = snapshot.reactorHeat;
+	for(unsigned int i = 0; i < components.size() && i < snapshot.cellPresent.size(); ++i) {
+		if(!components[i].get()) continue;
+		if(!snapshot.cellPresent[i]) {
+			components[i].reset();
+		} else {
+			components[i]->restoreState(snapshot.cellHeat[i], snapshot.cellUsage[i]);
+		}
+	}
+}
+
+size_t ReactorSnapshot::hash() const {
+	size_t h = std::hash<int>()(reactorHeat);
+	for(size_t i = 0; i < cellHeat.size(); ++i) {
+		h = h * 1000003 ^ std::hash<int>()(cellHeat[i]);
+		h = h * 1000003 ^ std::hash<int>()(cellUsage[i] * 2 + cellPresent[i]);
+	}
+	return h;
 }
 
 int getCyclesUntilFailure(int firstRunHeat, int secondRunHeat, int maxHeat) {
@@ -356,38 +466,365 @@ int getCyclesUntilFailure(int firstRunHeat, int secondRunHeat, int maxHeat) {
 	return (maxHeat - firstRunHeat - 1) / heatDiff + 1;
 }
 
-SimulationResults runSimulation(Reactor& initialReactor) {
+/***** Multi-cycle analysis *****/
+
+// Records the lowest and highest heat of every cell and of the hull over one fuel cycle
+class CycleMonitor : public TickObserver {
+public:
+	std::vector<int> minHeat;
+	std::vector<int> maxHeat;
+	int minReactorHeat;
+	int maxReactorHeat;
+
+	void reset(const ReactorSnapshot& start) {
+		minHeat = maxHeat = start.cellHeat;
+		minReactorHeat = maxReactorHeat = start.reactorHeat;
+	}
+
+	void onTick(Reactor& reactor) {
+		for(unsigned int i = 0; i < reactor.components.size(); ++i) {
+			ReactorComponent* comp = reactor.components[i].get();
+			int heat = comp ? comp->getCurrentHeat() : 0;
+			if(heat < minHeat[i]) minHeat[i] = heat;
+			if(heat > maxHeat[i]) maxHeat[i] = heat;
+		}
+		int heat = reactor.pendingSimState.reactorHeat;
+		if(heat < minReactorHeat) minReactorHeat = heat;
+		if(heat > maxReactorHeat) maxReactorHeat = heat;
+	}
+};
+
+// Apart from heat exchangers, every heat change within a tick is a constant amount, except where
+// heat is clamped at zero or a limit is reached.  So as long as no exchanger touches heat that changes
+// from cycle to cycle, cycles that stay clear of the clamps and limits are exact translations of each
+// other, which is what allows skipping them.  These are the static margins for that.
+struct LinearCycleBounds {
+	int maxIncrease;		// upper bound on the heat any cell or the hull gains within one tick
+	int maxCellDecrease;	// upper bound on the heat any component loses within one tick
+	int maxHullDecrease;
+	int hullLimit;			// reactor max heat in effect when the first component that changes hull heat ticks
+};
+
+static LinearCycleBounds getLinearCycleBounds(Reactor& reactor) {
+	LinearCycleBounds bounds;
+	bounds.maxIncrease = 0;
+	bounds.maxCellDecrease = 0;
+	bounds.maxHullDecrease = 0;
+	bounds.hullLimit = 10000;
+	int maxDissipation = 0;
+	bool hullModified = false;
+	for(auto& component : reactor.components) {	// row-major, the order components tick in
+		ReactorComponent* comp = component.get();
+		if(!comp) continue;
+		switch(comp->type) {
+			case URANIUM_CELL: case DUAL_URANIUM_CELL: case QUAD_URANIUM_CELL: {
+				int numCells = static_cast<UraniumCell*>(comp)->numCells;
+				int maxPulses = 1 + numCells / 2 + 4;
+				bounds.maxIncrease += numCells * maxPulses * (maxPulses + 1) / 2 * 4;
+				hullModified = true;
+				break;
+			}
+			case HEAT_VENT: case REACTOR_HEAT_VENT: case ADVANCED_HEAT_VENT: case OVERCLOCKED_HEAT_VENT: {
+				HeatVent* vent = static_cast<HeatVent*>(comp);
+				if(vent->heatDissipated > maxDissipation) maxDissipation = vent->heatDissipated;
+				if(vent->heatFromReactor > 0) {
+					bounds.maxIncrease += vent->heatFromReactor;
+					bounds.maxHullDecrease += vent->heatFromReactor;
+					hullModified = true;
+				}
+				break;
+			}
+			case REACTOR_PLATING: case CONTAINMENT_REACTOR_PLATING: case HEAT_CAPACITY_REACTOR_PLATING:
+				if(!hullModified) bounds.hullLimit += static_cast<ReactorPlating*>(comp)->heatAddition;
+				break;
+			default:
+				break;
+		}
+	}
+	// A component loses at most its own dissipation plus 4 from each neighboring component heat vent
+	bounds.maxCellDecrease = maxDissipation + 4 * 4;
+	return bounds;
+}
+
+// How many of the cycles following the one the monitor recorded can be skipped, given that the state
+// advanced by the same delta over the last two cycles.  Returns 0 if skipping is not provably exact.
+static int getSkippableCycles(const ReactorSnapshot& b0, const ReactorSnapshot& b1, const ReactorSnapshot& b2, const CycleMonitor& monitor, Reactor& reactor, const LinearCycleBounds& bounds) {
+	if(b0.cellPresent != b2.cellPresent || b1.cellPresent != b2.cellPresent) return 0;
+	if(b0.cellUsage != b2.cellUsage || b1.cellUsage != b2.cellUsage) return 0;
+	long skip = Reactor::fuelTicks;	// effectively unbounded; clamped by the limits below
+
+	// Constrains skip so that value + skip * delta stays clear of the zero clamp and the limit
+	auto constrain = [&](int delta, int minValue, int maxValue, int decrease, long limit) {
+		if(delta == 0) return;
+		if(minValue <= decrease) { skip = 0; return; }	// may have been clamped during the recorded cycle
+		if(delta > 0) {
+			long s = (limit - bounds.maxIncrease - maxValue) / delta;
+			if(s < skip) skip = s;
+		} else {
+			long s = (minValue - decrease - 1) / -delta;
+			if(s < skip) skip = s;
+		}
+	};
+
+	int hullDelta = b2.reactorHeat - b1.reactorHeat;
+	if(b1.reactorHeat - b0.reactorHeat != hullDelta) return 0;
+	std::vector<int> deltas(b2.cellHeat.size());
+	for(unsigned int i = 0; i < deltas.size(); ++i) {
+		deltas[i] = b2.cellHeat[i] - b1.cellHeat[i];
+		if(b1.cellHeat[i] - b0.cellHeat[i] != deltas[i]) return 0;
+	}
+
+	// Exchangers balance heat ratios, so everything they read must repeat exactly
+	for(int y = 0; y < reactor.height; ++y) {
+		for(int x = 0; x < reactor.width; ++x) {
+			ReactorComponent* comp = reactor.get(x, y);
+			if(!comp) continue;
+			ComponentType type = comp->type;
+			if(type != HEAT_EXCHANGER && type != ADVANCED_HEAT_EXCHANGER && type != CORE_HEAT_EXCHANGER && type != COMPONENT_HEAT_EXCHANGER) continue;
+			HeatExchanger* exchanger = static_cast<HeatExchanger*>(comp);
+			if(deltas[y * reactor.width + x] != 0) return 0;
+			if(exchanger->transferToCore > 0 && hullDelta != 0) return 0;
+			if(exchanger->transferToAdjacent > 0) {
+				if(x > 0 && deltas[y * reactor.width + x - 1] != 0) return 0;
+				if(x < reactor.width - 1 && deltas[y * reactor.width + x + 1] != 0) return 0;
+				if(y > 0 && deltas[(y - 1) * reactor.width + x] != 0) return 0;
+				if(y < reactor.height - 1 && deltas[(y + 1) * reactor.width + x] != 0) return 0;
+			}
+		}
+	}
+
+	constrain(hullDelta, monitor.minReactorHeat, monitor.maxReactorHeat, bounds.maxHullDecrease, bounds.hullLimit - 1);	// meltdown at >= limit
+	for(unsigned int i = 0; i < deltas.size() && skip > 0; ++i) {
+		if(!b2.cellPresent[i]) continue;
+		constrain(deltas[i], monitor.minHeat[i], monitor.maxHeat[i], bounds.maxCellDecrease, reactor.components[i]->getMaxHeat());	// destroyed at > limit
+	}
+	return skip > 0 ? (int)skip : 0;
+}
+
+// runExactCycles() result when the simulation is cancelled
+static const int cyclesCancelled = -2;
+
+// Runs fuel cycles after the first (which initialReactor has completed and committed) until one fails.
+// Returns the number of cycles completed before the failing one, -1 if the reactor reaches a
+// repeating state and so never fails, or cyclesCancelled.
+static int runExactCycles(Reactor& initialReactor, const SimulationOptions& options) {
+	Reactor cycleReactor(initialReactor);
+	CycleMonitor monitor;
+	cycleReactor.tickObserver = &monitor;
+	LinearCycleBounds bounds = getLinearCycleBounds(cycleReactor);
+	setTracePhase(cycleReactor, TRACE_RERUN);
+
+	std::unordered_multimap<size_t, ReactorSnapshot> seen;
+	std::vector<ReactorSnapshot> boundaries;	// states at the ends of consecutively simulated cycles
+	boundaries.push_back(cycleReactor.captureSnapshot());
+	seen.insert(std::make_pair(boundaries.back().hash(), boundaries.back()));
+
+	int completed = 1;
+	for(int simulated = 1; ; ++simulated) {
+		if(simulated >= options.maxCycles && boundaries.size() >= 2) {
+			// Give up on exactness and extrapolate from the last two cycles.  getCyclesUntilFailure()
+			// counts prev, the state after cycle completed - 1, as cycle 1.
+			const ReactorSnapshot& prev = boundaries[boundaries.size() - 2];
+			const ReactorSnapshot& last = boundaries.back();
+			int minCycles = getCyclesUntilFailure(prev.reactorHeat, last.reactorHeat, initialReactor.getMaxHeat());
+			for(unsigned int i = 0; i < last.cellHeat.size(); ++i) {
+				if(!last.cellPresent[i]) continue;
+				int cuf = getCyclesUntilFailure(prev.cellHeat[i], last.cellHeat[i], cycleReactor.components[i]->getMaxHeat());
+				if(cuf != -1 && (minCycles == -1 || cuf < minCycles)) minCycles = cuf;
+			}
+			return minCycles == -1 ? -1 : completed - 2 + minCycles;
+		}
+
+		cycleReactor.resetUsage();
+		monitor.reset(boundaries.back());
+		RunUntilStopReason reason = cycleReactor.runUntil(true, true, false, true);
+		if(reason == STOPPED_ON_CANCELLED) {
+			return cyclesCancelled;
+		}
+		statIncrement(STAT_CYCLES_SIMULATED);
+		if(reason != STOPPED_ON_FUEL_USED) {
+			return completed;
+		}
+		cycleReactor.commit();
+		completed++;
+
+		ReactorSnapshot snapshot = cycleReactor.captureSnapshot();
+		size_t hash = snapshot.hash();
+		auto range = seen.equal_range(hash);
+		for(auto itr = range.first; itr != range.second; ++itr) {
+			if(itr->second == snapshot) return -1;	// periodic from here on
+		}
+		seen.insert(std::make_pair(hash, snapshot));
+		boundaries.push_back(snapshot);
+
+		if(boundaries.size() >= 3) {
+			int skip = getSkippableCycles(boundaries[boundaries.size() - 3], boundaries[boundaries.size() - 2], snapshot, monitor, cycleReactor, bounds);
+			if(skip > 0) {
+				ReactorSnapshot target = snapshot;
+				const ReactorSnapshot& prev = boundaries[boundaries.size() - 2];
+				target.reactorHeat += skip * (snapshot.reactorHeat - prev.reactorHeat);
+				for(unsigned int i = 0; i < target.cellHeat.size(); ++i) {
+					target.cellHeat[i] += skip * (snapshot.cellHeat[i] - prev.cellHeat[i]);
+				}
+				cycleReactor.restoreSnapshot(target);
+				completed += skip;
+				statAdd(STAT_CYCLES_SKIPPED, skip);
+				boundaries.clear();
+				boundaries.push_back(target);
+			}
+		}
+	}
+}
+
+/***** Stress report *****/
+
+// Fills in a zeroed StressReport while attached to the reactor of the first run
+class StressMonitor : public TickObserver {
+public:
+	StressReport& report;
+
+	StressMonitor(StressReport& report) : report(report) {}
+
+	void onTick(Reactor& reactor) {
+		for(unsigned int i = 0; i < reactor.components.size(); ++i) {
+			ReactorComponent* comp = reactor.components[i].get();
+			if(!comp) continue;
+			int maxHeat = comp->getMaxHeat();
+			int heat = comp->getCurrentHeat();
+			float* cell = &report.cells[i * STRESS_FIELD_COUNT];
+			if(heat > cell[STRESS_PEAK_HEAT]) {
+				cell[STRESS_PEAK_HEAT] = heat;
+				if(maxHeat > 0) cell[STRESS_PEAK_HEAT_RATIO] = (float)heat / maxHeat;
+			}
+			if(maxHeat > 0 && heat * 10 >= maxHeat * 9) cell[STRESS_TICKS_ABOVE_90]++;
+		}
+		int heat = reactor.pendingSimState.reactorHeat;
+		if(heat > report.peakReactorHeat) {
+			report.peakReactorHeat = heat;
+			report.peakReactorHeatRatio = (float)heat / reactor.getMaxHeat();
+		}
+	}
+
+	void finish(Reactor& reactor) {
+		for(unsigned int i = 0; i < reactor.components.size(); ++i) {
+			ReactorComponent* comp = reactor.components[i].get();
+			if(comp && comp->getDurability() > 0) {
+				report.cells[i * STRESS_FIELD_COUNT + STRESS_WEAR] = (float)comp->getUsage() / comp->getDurability();
+			}
+		}
+	}
+};
+
+
+/***** Thresholds *****/
+
+static RejectReason checkThresholds(const SimulationResults& results, const SimulationThresholds& thresholds) {
+	if(results.euPerTick < thresholds.minEUPerTick) return REJECT_EU_PER_TICK;
+	if(results.overallEUPerTick < thresholds.minOverallEUPerTick) return REJECT_OVERALL_EU_PER_TICK;
+	if(results.mark > thresholds.maxMark) return REJECT_MARK;
+	return REJECT_NONE;
+}
+
+// The tick count a cycle must stay within for overallEUPerTick to meet its threshold, plus one, so
+// that cooldowns can be stopped there.  timeoutTicks if it does not come first.
+static int getCycleTickLimit(const SimulationResults& results, const SimulationThresholds& thresholds) {
+	if(thresholds.minOverallEUPerTick <= 0) return Reactor::timeoutTicks;
+	int64_t limit = (int64_t)results.totalEUPerCycle / thresholds.minOverallEUPerTick + 1;
+	return limit < Reactor::timeoutTicks ? (int)limit : Reactor::timeoutTicks;
+}
+
+
+static SimulationResults runSimulationPhases(Reactor& initialReactor, const SimulationOptions& options) {
 	SimulationResults results;
-	initialReactor.initializeSimulation();
+	initialReactor.initializeSimulation(options.initialState);
 
 	results.totalCost = initialReactor.getTotalCost();
+	if(options.stress) {
+		*options.stress = StressReport();
+		options.stress->cells.assign(initialReactor.components.size() * STRESS_FIELD_COUNT, 0);
+	}
 
-	if(!initialReactor.numUraniumCells) {
-		return results;	// no fuel
+	if(!initialReactor.numUraniumCells || !initialReactor.fuelEndTick) {
+		statIncrement(STAT_BRANCH + BRANCH_NO_FUEL);
+		return results;	// no fuel, or only used up fuel
 	}
 
-	RunUntilStopReason firstStopReason = initialReactor.runUntil(true, true, false, true);
+	setTracePhase(initialReactor, TRACE_FIRST_RUN);
+	RunUntilStopReason firstStopReason;
+	{
+		StatPhaseTimer timer(STAT_PHASE_FIRST_RUN);
+		if(options.stress) {
+			StressMonitor monitor(*options.stress);
+			TickObserver* observer = initialReactor.tickObserver;
+			initialReactor.tickObserver = &monitor;
+			firstStopReason = initialReactor.runUntil(true, true, false, true);
+			initialReactor.tickObserver = observer;
+			monitor.finish(initialReactor);
+		} else {
+			firstStopReason = initialReactor.runUntil(true, true, false, true);
+		}
+	}
 
+	if(firstStopReason == STOPPED_ON_CANCELLED) {
+		// Possibly before the first tick, so there is nothing to compute EU/t from
+		results.incomplete = true;
+		return results;
+	}
 	if(firstStopReason == STOPPED_ON_FUEL_USED) {
 		initialReactor.commit();
 	}
 
+	// Less than fuelTicks when started from used fuel; a mark I cycle is the first run
+	int firstRunTicks = initialReactor.curSimState.curTick;
 	results.totalEUPerCycle = initialReactor.curSimState.euGenerated;
-	results.euPerTick = results.totalEUPerCycle / initialReactor.curSimState.curTick;
+	results.euPerTick = results.totalEUPerCycle / firstRunTicks;
 	results.efficiency = (float)results.euPerTick / 5.0 / (float)initialReactor.numUraniumCells;
 	results.usesSingleUseCoolant = initialReactor.usesSingleUseCoolant;
 
+	if(options.listener) {
+		options.listener->onFirstRun(results, firstStopReason);
+	}
+	if(initialReactor.isCancelled()) {
+		results.incomplete = true;
+		return results;
+	}
+
+	// overallEUPerTick is at most euPerTick
+	const SimulationThresholds& thresholds = options.thresholds;
+	if(results.euPerTick < thresholds.minEUPerTick) {
+		results.rejected = REJECT_EU_PER_TICK;
+		return results;
+	}
+	if(results.euPerTick < thresholds.minOverallEUPerTick) {
+		results.rejected = REJECT_OVERALL_EU_PER_TICK;
+		return results;
+	}
+	int cycleTickLimit = getCycleTickLimit(results, thresholds);
+
 	if(firstStopReason == STOPPED_ON_COMPONENT_FAILED) {
+		statIncrement(STAT_BRANCH + BRANCH_COMPONENT_FAILED);
 		results.numIterationsBeforeFailure = 0;
 		results.ticksUntilComponentFailure = initialReactor.curSimState.curTick;
+		// Mark III if it ran for at least 10% of the fuel lifetime, otherwise IV or V
+		if(thresholds.maxMark < (initialReactor.curSimState.curTick * 100 / Reactor::fuelTicks >= 10 ? 3 : 4)) {
+			results.rejected = REJECT_MARK;
+			return results;
+		}
 
 		// Rollback the component failure and track time until cooled down
+		StatPhaseTimer cooldownTimer(STAT_PHASE_COOLDOWN);
 		Reactor cooldownReactor(initialReactor);
 		cooldownReactor.rollback();
 		cooldownReactor.removeFuel();
 		cooldownReactor.ignoreComponentDestroyed = true;
-		RunUntilStopReason cooldownStopReason = cooldownReactor.runUntil(false, false, true, false);
+		setTracePhase(cooldownReactor, TRACE_COOLDOWN);
+		RunUntilStopReason cooldownStopReason = cooldownReactor.runUntil(false, false, true, false, cycleTickLimit);
+		cooldownTimer.stop();
 		cooldownReactor.commit();
+		if(cooldownStopReason == STOPPED_ON_MAX_TICKS && cooldownReactor.curSimState.curTick >= cycleTickLimit && cycleTickLimit < Reactor::timeoutTicks) {
+			results.rejected = REJECT_OVERALL_EU_PER_TICK;
+			return results;
+		}
 		if(cooldownStopReason == STOPPED_ON_COOLED_DOWN) {
 			results.cooldownTicks = cooldownReactor.curSimState.curTick - initialReactor.pendingSimState.curTick;
 			results.cycleTicks = cooldownReactor.curSimState.curTick;
@@ -398,15 +835,25 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 			//std::cout << "\n\n";
 			//printReactor(cooldownReactor);
 			//std::cout << cooldownReactor.heat << "\n";
+		} else if(cooldownStopReason == STOPPED_ON_CANCELLED) {
+			results.incomplete = true;
+			return results;
 		} else {
 			cout << "Invalid stop reason1\n";
 			return results;
 		}
 
 		// Run another reactor until meltdown or the fuel is used up, with the component failed
+		StatPhaseTimer rufTimer(STAT_PHASE_RUN_UNTIL_FINISH);
 		Reactor runUntilFinishReactor(initialReactor);
 		runUntilFinishReactor.commit();
+		setTracePhase(runUntilFinishReactor, TRACE_RUN_UNTIL_FINISH);
 		RunUntilStopReason rufStopReason = runUntilFinishReactor.runUntil(true, true, false, false);
+		rufTimer.stop();
+		if(rufStopReason == STOPPED_ON_CANCELLED) {
+			results.incomplete = true;
+			return results;
+		}
 
 		if(initialReactor.curSimState.curTick * 100 / Reactor::fuelTicks >= 10) {
 			// If the reactor ran for at least 10% of fuel lifetime before a component broke, it's a mark III
@@ -431,6 +878,7 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 		rufCooldownReactor.removeFuel();
 		RunUntilStopReason rufCooldownStopReason = rufCooldownReactor.runUntil(false, false, true, false);*/
 	} else if(firstStopReason == STOPPED_ON_MELTDOWN) {
+		statIncrement(STAT_BRANCH + BRANCH_MELTDOWN);
 		results.numIterationsBeforeFailure = 0;
 		results.ticksUntilMeltdown = initialReactor.curSimState.curTick;
 
@@ -440,13 +888,24 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 		} else {
 			results.mark = 5;
 		}
+		if(results.mark > thresholds.maxMark) {
+			results.rejected = REJECT_MARK;
+			return results;
+		}
 
 		// Roll back the meltdown and run until cooled down
+		StatPhaseTimer cooldownTimer(STAT_PHASE_COOLDOWN);
 		Reactor cooldownReactor(initialReactor);
 		cooldownReactor.rollback();
 		cooldownReactor.removeFuel();
 		cooldownReactor.ignoreComponentDestroyed = true;
-		RunUntilStopReason mdCooldownStopReason = cooldownReactor.runUntil(false, false, true, false);
+		setTracePhase(cooldownReactor, TRACE_COOLDOWN);
+		RunUntilStopReason mdCooldownStopReason = cooldownReactor.runUntil(false, false, true, false, cycleTickLimit);
+		cooldownTimer.stop();
+		if(mdCooldownStopReason == STOPPED_ON_MAX_TICKS && cooldownReactor.pendingSimState.curTick >= cycleTickLimit && cycleTickLimit < Reactor::timeoutTicks) {
+			results.rejected = REJECT_OVERALL_EU_PER_TICK;
+			return results;
+		}
 		if(mdCooldownStopReason == STOPPED_ON_COOLED_DOWN) {
 			results.cooldownTicks = cooldownReactor.curSimState.curTick - initialReactor.pendingSimState.curTick;
 			results.cycleTicks = cooldownReactor.curSimState.curTick;
@@ -454,6 +913,9 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 		} else if(mdCooldownStopReason == STOPPED_ON_MAX_TICKS) {
 			results.timedOut = true;
 			results.cycleTicks = -1;
+		} else if(mdCooldownStopReason == STOPPED_ON_CANCELLED) {
+			results.incomplete = true;
+			return results;
 		} else {
 			cout << "Invalid stop reason2\n";
 			return results;
@@ -462,17 +924,22 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 		// Reactor is either a mark I or a mark II.
 		if(initialReactor.curSimState.totalHeat <= 0) {
 			// It's a mark I with no total heat at the end of each cycle
+			statIncrement(STAT_BRANCH + BRANCH_COLD_AFTER_RUN);
 			results.mark = 1;
 			results.overallEUPerTick = results.euPerTick;
-			results.cycleTicks = Reactor::fuelTicks;
+			results.cycleTicks = firstRunTicks;
 		} else {
 			// It may still be a mark I, need to run additional tests
+			statIncrement(STAT_BRANCH + BRANCH_RERUN);
 
 			// Test the cooldown time (may not be needed, but may as well include it in the results)
+			StatPhaseTimer cooldownTimer(STAT_PHASE_COOLDOWN);
 			Reactor cooldownReactor(initialReactor);
 			cooldownReactor.removeFuel();
 			cooldownReactor.ignoreComponentDestroyed = true;
+			setTracePhase(cooldownReactor, TRACE_COOLDOWN);
 			RunUntilStopReason cooldownStopReason = cooldownReactor.runUntil(false, false, true, false);
+			cooldownTimer.stop();
 			if(cooldownStopReason == STOPPED_ON_COOLED_DOWN) {
 				results.cooldownTicks = cooldownReactor.curSimState.curTick - initialReactor.pendingSimState.curTick;
 				results.cycleTicks = cooldownReactor.curSimState.curTick;
@@ -480,15 +947,38 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 			} else if(cooldownStopReason == STOPPED_ON_MAX_TICKS) {
 				results.timedOut = true;
 				results.cycleTicks = -1;
+			} else if(cooldownStopReason == STOPPED_ON_CANCELLED) {
+				results.incomplete = true;
+				return results;
 			} else {
 				cout << "Invalid stop reason3\n";
 				return results;
 			}
 
+			if(options.exactCycles) {
+				StatPhaseTimer cyclesTimer(STAT_PHASE_RERUN);
+				int cycles = runExactCycles(initialReactor, options);
+				cyclesTimer.stop();
+				if(cycles == cyclesCancelled) {
+					results.incomplete = true;
+				} else if(cycles == -1) {
+					results.mark = 1;
+					results.overallEUPerTick = results.euPerTick;
+					results.cycleTicks = firstRunTicks;
+				} else {
+					results.mark = 2;
+					results.numIterationsBeforeFailure = cycles;
+				}
+				return results;
+			}
+
 			// Reset the reactor ticks, fuel usage, and condensators, but don't reset the heat.  Run it again and see what happens.
+			StatPhaseTimer rerunTimer(STAT_PHASE_RERUN);
 			Reactor rerunReactor(initialReactor);
 			rerunReactor.resetUsage();
+			setTracePhase(rerunReactor, TRACE_RERUN);
 			RunUntilStopReason rerunStopReason = rerunReactor.runUntil(true, true, false, true);
+			rerunTimer.stop();
 			if(rerunStopReason == STOPPED_ON_MELTDOWN) {
 				// It's a mark II that can only run 1 cycle before meltdown
 				results.mark = 2;
@@ -517,12 +1007,15 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 				if(minCyclesUntilFailure == -1) {
 					results.mark = 1;
 					results.overallEUPerTick = results.euPerTick;
-					results.cycleTicks = Reactor::fuelTicks;
+					results.cycleTicks = firstRunTicks;
 				} else {
 					results.mark = 2;
 					results.numIterationsBeforeFailure = minCyclesUntilFailure;
 				}
 
+			} else if(rerunStopReason == STOPPED_ON_CANCELLED) {
+				results.incomplete = true;
+				return results;
 			} else {
 				cout << "Invalid stop reason4\n";
 				return results;
@@ -536,6 +1029,46 @@ SimulationResults runSimulation(Reactor& initialReactor) {
 	return results;
 }
 
+#ifdef REACTORSIM_USDT
+// FNV-1a over the layout, so probes can group simulations by layout
+static uint64_t getLayoutHash(Reactor& reactor) {
+	uint64_t hash = 14695981039346656037ULL;
+	hash = (hash ^ (uint64_t)reactor.width) * 1099511628211ULL;
+	for(auto& component : reactor.components) {
+		hash = (hash ^ (uint64_t)(component.get() ? component->type : COMPONENT_NONE)) * 1099511628211ULL;
+	}
+	return hash;
+}
+#endif
+
+SimulationResults runSimulation(Reactor& initialReactor, const SimulationOptions& options) {
+#ifdef REACTORSIM_USDT
+	// Hashing the layout costs a pass over it, so only while a tracer is attached
+	uint64_t layoutHash = SIM_PROBE_ENABLED(simulation__start) || SIM_PROBE_ENABLED(simulation__done) ? getLayoutHash(initialReactor) : 0;
+	SIM_PROBE3(simulation__start, layoutHash, initialReactor.width, initialReactor.numUraniumCells);
+#endif
+	SimulationResults results = runSimulationPhases(initialReactor, options);
+	if(results.rejected != REJECT_NONE) {
+		// Rejected before the mark was known
+		if(results.mark == 0) results.mark = -1;
+	} else if(!results.incomplete) {
+		results.rejected = checkThresholds(results, options.thresholds);
+	}
+#ifdef REACTORSIM_USDT
+	SIM_PROBE5(simulation__done, layoutHash, results.mark, (int)results.euPerTick, results.numIterationsBeforeFailure, (int)results.incomplete);
+#endif
+	if(options.countOutcome) countSimulationOutcome(results);
+	return results;
+}
+
+void countSimulationOutcome(const SimulationResults& results) {
+	statIncrement(STAT_SIMULATIONS);
+	if(results.rejected == REJECT_NONE && results.mark >= 0 && results.mark < numMarks) statIncrement(STAT_MARK + results.mark);
+	if(results.timedOut) statIncrement(STAT_TIMED_OUT_COOLDOWNS);
+	if(results.incomplete) statIncrement(STAT_INCOMPLETE_SIMULATIONS);
+	if(results.rejected != REJECT_NONE) statIncrement(STAT_REJECTED_SIMULATIONS);
+}
+
 
 /***** HeatVent *****/
 
@@ -677,7 +1210,7 @@ void Condensator::rollback() {
 /***** UraniumCell *****/
 
 void UraniumCell::tick(SimPhase phase) {
-	if(pendingUsage <= maxUsage) {
+	if(pendingUsage <= maxUsage && reactor->producing) {
 
 		for(int cellNum = 0; cellNum < numCells; ++cellNum) {
 			int pulses = 1 + numCells / 2;
@@ -4,6 +4,10 @@
 #include <vector>
 #include <memory>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "simtrace.hpp"
 
 using std::shared_ptr;
 
@@ -53,6 +57,14 @@ enum SimPhase {
 	PHASE_POWER
 };
 
+// Which acceptance threshold a simulation was rejected for
+enum RejectReason {
+	REJECT_NONE,
+	REJECT_EU_PER_TICK,
+	REJECT_OVERALL_EU_PER_TICK,
+	REJECT_MARK
+};
+
 struct SimulationResults {
 	float efficiency = 0;			// efficiency value (eu during operation / 5 / numUraniumCells)
 	float totalEUPerCycle = 0;	// total EU produced in each complete cycle (run/stop/cooldown) of the reactor, until meltdown, component failure, or fuel used
@@ -62,11 +74,75 @@ struct SimulationResults {
 	bool timedOut = false;		// If the reactor reached a timeout before cooling down
 	int cooldownTicks = 0;		// Number of ticks to cooldown after a cycle
 	int cycleTicks = 0;			// Number of ticks in a cycle (including cooldown if necessary)
-	int mark = 0;				// Mark level (0-5)
+	int mark = 0;				// Mark level (0-5), -1 if rejected before it was known
 	int numIterationsBeforeFailure = -1;	// Number of complete fuel-used-up iterations the reactor undergoes before meltdown or component failure, without cooldown
 	int ticksUntilMeltdown = -1;	// If meltdown before 10000 ticks, number of ticks until the meltdown
 	int ticksUntilComponentFailure = -1;	// If component failure before 10000, number of ticks until the failure
 	int totalCost = 0;			// Sum of component costs
+	bool incomplete = false;	// Later phases were cancelled; the fields they compute keep their defaults
+	RejectReason rejected = REJECT_NONE;	// Failed a threshold; if it was known early, later fields keep their defaults
+};
+
+// Acceptance thresholds.  The simulation stops as soon as the results provably fail one of them.
+struct SimulationThresholds {
+	int minEUPerTick = 0;
+	int minOverallEUPerTick = 0;
+	int maxMark = 5;
+};
+
+class SimulationListener;
+
+// Per-cell diagnostics of the first run (the fuel cycle the results are scored on), recorded as it
+// is simulated.  cells holds numStressFields values per cell, indexed by StressField.
+enum StressField {
+	STRESS_PEAK_HEAT,			// highest heat the component reached
+	STRESS_PEAK_HEAT_RATIO,		// peak heat / getMaxHeat(); above 1 for a component that failed
+	STRESS_TICKS_ABOVE_90,		// ticks spent at or above 90% of getMaxHeat()
+	STRESS_WEAR,				// reflector or condensator usage / durability at the end of the run
+	STRESS_FIELD_COUNT
+};
+
+struct StressReport {
+	std::vector<float> cells;
+	int peakReactorHeat = 0;
+	float peakReactorHeatRatio = 0;	// to the hull's max heat at that tick
+};
+
+struct ReactorSnapshot;
+
+struct SimulationOptions {
+	// Find numIterationsBeforeFailure for mark II reactors by simulating cycle after cycle (skipping
+	// ahead only where the outcome is provable) instead of extrapolating from the first two cycles
+	bool exactCycles = false;
+	// Upper bound on the number of fuel cycles simulated with exactCycles.  Beyond it, the remaining
+	// cycles are extrapolated from the last two.
+	int maxCycles = 1000;
+	// Notified once the first run has finished, before cooldowns and reruns; not owned
+	SimulationListener* listener = 0;
+	// Filled in during the first run if set; not owned
+	StressReport* stress = 0;
+	SimulationThresholds thresholds;
+	// State to start from instead of a cold reactor with fresh fuel; not owned.  Fuel cell usage is
+	// in ticks, and the first run ends once the least used fuel cell is used up.  Its cellPresent
+	// must be set for every cell; components absent from it are removed.
+	const ReactorSnapshot* initialState = 0;
+	// Count the simulation and its outcome (mark, incomplete, rejected) in the stats.  Off for an
+	// attempt that may be discarded, which countSimulationOutcome() then counts if it is kept.
+	bool countOutcome = true;
+};
+
+// Committed state of a reactor, apart from its layout.  Used to detect repeating states and to
+// restore a reactor to a known point.
+struct ReactorSnapshot {
+	int reactorHeat = 0;
+	std::vector<int> cellHeat;		// heat of each cell's component
+	std::vector<int> cellUsage;		// fuel or reflector usage, or condensator stored heat
+	std::vector<unsigned char> cellPresent;	// 0 for empty cells and destroyed components
+
+	bool operator==(const ReactorSnapshot& other) const {
+		return reactorHeat == other.reactorHeat && cellHeat == other.cellHeat && cellUsage == other.cellUsage && cellPresent == other.cellPresent;
+	}
+	size_t hash() const;
 };
 
 class Committable {
@@ -97,6 +173,9 @@ public:
 	virtual int getCurrentHeat() { return 0; }
 	virtual int alterHeat(int heat) { return heat; }
 	virtual void resetUsage() {}	// resets condensator use, reflector use, and uranium cell use
+	virtual int getUsage() { return 0; }	// the value resetUsage() resets
+	virtual int getDurability() { return 0; }	// usage at which it is used up; 0 if it does not wear out
+	virtual void restoreState(int heat, int usage) {}	// sets the committed heat and usage
 	bool isDestroyed() { return pendingDestroyed; }
 	void setDestroyed(bool d);
 
@@ -123,6 +202,7 @@ public:
 	virtual int getMaxHeat() { return maxHeat; }
 	virtual int getCurrentHeat() { return pendingHeat; }
 	virtual int alterHeat(int heat);
+	virtual void restoreState(int heat, int usage) { lastHeat = pendingHeat = heat; }
 	virtual ~Heatable() {}
 	virtual void commit() { ReactorComponent::commit(); lastHeat = pendingHeat; }
 	virtual void rollback() { ReactorComponent::rollback(); pendingHeat = lastHeat; }
@@ -133,7 +213,77 @@ enum RunUntilStopReason {
 	STOPPED_ON_FUEL_USED,
 	STOPPED_ON_COOLED_DOWN,
 	STOPPED_ON_COMPONENT_FAILED,
-	STOPPED_ON_MAX_TICKS
+	STOPPED_ON_MAX_TICKS,
+	STOPPED_ON_CANCELLED
+};
+
+// Receives the results that are known after the first run of runSimulation(): efficiency,
+// totalEUPerCycle, euPerTick, usesSingleUseCoolant and totalCost.  Cancelling the reactor's
+// cancelToken from here (or from any other thread) abandons the remaining phases.
+class SimulationListener {
+public:
+	virtual void onFirstRun(const SimulationResults& partialResults, RunUntilStopReason stopReason) = 0;
+	virtual ~SimulationListener() {}
+};
+
+enum CancelReason {
+	CANCEL_NONE,
+	CANCEL_REQUESTED,
+	CANCEL_TICK_BUDGET,
+	CANCEL_DEADLINE
+};
+
+// Stops a simulation when cancelled from any thread, or once it has used up a tick budget or passed
+// a deadline.  Reactor::runUntil() consumes one tick of it before every tick it simulates; reactors
+// copied from one with a token share it, so the budget covers every phase of runSimulation().
+class CancellationToken {
+public:
+	CancellationToken() : reason(CANCEL_NONE), tickBudget(0), ticksUsed(0), hasDeadline(false) {}
+
+	void cancel() { stop(CANCEL_REQUESTED); }
+	void setTickBudget(uint64_t ticks) { tickBudget = ticks; }	// 0 for no budget
+	void setDeadline(std::chrono::steady_clock::time_point when) { deadline = when; hasDeadline = true; }
+	void copyDeadline(const CancellationToken& other) { deadline = other.deadline; hasDeadline = other.hasDeadline; }
+
+	bool isCancelled() const { return reason.load(std::memory_order_relaxed) != CANCEL_NONE; }
+	CancelReason getReason() const { return (CancelReason)reason.load(std::memory_order_relaxed); }
+	uint64_t getTicksUsed() const { return ticksUsed; }
+	uint64_t getTickBudget() const { return tickBudget; }
+
+	// Returns false if the tick must not be simulated.  Only called by the simulating thread; the
+	// clock is read on the first tick and every 1024 after.
+	bool consumeTick() {
+		if(isCancelled()) return false;
+		ticksUsed++;
+		if(tickBudget && ticksUsed > tickBudget) {
+			stop(CANCEL_TICK_BUDGET);
+			return false;
+		}
+		if(hasDeadline && (ticksUsed & 1023) == 1 && std::chrono::steady_clock::now() >= deadline) {
+			stop(CANCEL_DEADLINE);
+			return false;
+		}
+		return true;
+	}
+
+private:
+	void stop(CancelReason r) {
+		int expected = CANCEL_NONE;
+		reason.compare_exchange_strong(expected, r);
+	}
+
+	std::atomic<int> reason;
+	uint64_t tickBudget;
+	uint64_t ticksUsed;
+	bool hasDeadline;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+// Receives the pending state after every tick simulated by Reactor::runUntil()
+class TickObserver {
+public:
+	virtual void onTick(Reactor& reactor) = 0;
+	virtual ~TickObserver() {}
 };
 
 class Reactor : public Committable {
@@ -150,6 +300,11 @@ public:
 	int maxHeat;
 
 	bool ignoreComponentDestroyed;
+	bool producing;	// false while switched off (by redstone); fuel cells then do nothing
+
+	TraceSink* traceSink;	// not owned; only consulted when traceCompiledIn
+	TickObserver* tickObserver;	// not owned; may be null
+	CancellationToken* cancelToken;	// not owned; may be null
 
 	Reactor(int extraChambers);
 	Reactor(const Reactor& other);
@@ -192,20 +347,32 @@ public:
 
 	int numUraniumCells;
 	bool usesSingleUseCoolant;
+	int fuelEndTick;	// tick at which the fuel is used up; fuelTicks unless started with used fuel
 
 	SimulationState curSimState;
 	SimulationState pendingSimState;
 
-	RunUntilStopReason runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed);
+	// Also stops (with STOPPED_ON_MAX_TICKS) once the tick count reaches maxTicks
+	RunUntilStopReason runUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed, int maxTicks = timeoutTicks);
 	void runTickPhase(SimPhase phase);
 	void runTick();
 	void removeFuel();
-	void initializeSimulation();
+	void initializeSimulation(const ReactorSnapshot* initialState = 0);	// cold with fresh fuel if null
 
 	void resetUsage();
+	int getFuelTicksLeft();
+
+	bool isCancelled() const { return cancelToken && cancelToken->isCancelled(); }
+
+	ReactorSnapshot captureSnapshot();
+	void restoreSnapshot(const ReactorSnapshot& snapshot);
+
+private:
+	RunUntilStopReason runTicksUntil(bool stopOnMeltdown, bool stopOnFuelUsed, bool stopOnCooledDown, bool stopOnComponentFailed, int maxTicks);
 };
 
-SimulationResults runSimulation(Reactor& reactor);
+SimulationResults runSimulation(Reactor& reactor, const SimulationOptions& options = SimulationOptions());
+void countSimulationOutcome(const SimulationResults& results);
 
 
 class HeatVent : public Heatable {
@@ -291,6 +458,9 @@ public:
 	int getMaxHeat();
 	int getCurrentHeat();
 	int alterHeat(int heat);
+	int getUsage() { return pendingStoredHeat; }
+	int getDurability() { return maxStoredHeat; }
+	void restoreState(int heat, int usage) { lastStoredHeat = pendingStoredHeat = usage; }
 
 	Condensator* clone() {
 		return new Condensator(*this);
@@ -324,6 +494,8 @@ public:
 	void commit();
 	void rollback();
 	void resetUsage();
+	int getUsage() { return pendingUsage; }
+	void restoreState(int heat, int usage) { lastUsage = pendingUsage = usage; }
 
 	UraniumCell* clone() {
 		return new UraniumCell(*this);
@@ -357,6 +529,9 @@ public:
 	void commit();
 	void rollback();
 	void resetUsage();
+	int getUsage() { return pendingUsage; }
+	int getDurability() { return maxUsage; }
+	void restoreState(int heat, int usage) { lastUsage = pendingUsage = usage; }
 
 	NeutronReflector* clone() {
 		return new NeutronReflector(*this);
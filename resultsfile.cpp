@@ -0,0 +1,291 @@
+#include "resultsfile.hpp"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+
+namespace reactorsim {
+
+namespace {
+
+const uint32_t headerMagic = 0x53525352;	// "RSRS"
+const uint32_t footerMagic = 0x46525352;	// "RSRF"
+const uint32_t formatVersion = 2;
+const int headerSize = 16;
+const int trailerSize = 8;
+const int footerSize = 24 + trailerSize;
+
+int64_t tell(FILE* file) {
+#ifdef _WIN32
+	return _ftelli64(file);
+#else
+	return ftello(file);
+#endif
+}
+
+bool seek(FILE* file, int64_t offset, int whence) {
+#ifdef _WIN32
+	return _fseeki64(file, offset, whence) == 0;
+#else
+	return fseeko(file, offset, whence) == 0;
+#endif
+}
+
+template<class T>
+void put(std::vector<uint8_t>& column, T value) {
+	size_t pos = column.size();
+	column.resize(pos + sizeof(T));
+	memcpy(&column[pos], &value, sizeof(T));
+}
+
+// Bytes per row of each column, in ResultsColumn order
+const int columnSizes[COLUMN_COUNT] = { 1, resultsLayoutStride, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 1, 1, 1 };
+
+uint64_t getBlockSize(uint64_t rows) {
+	uint64_t size = 0;
+	for(int c = 0; c < COLUMN_COUNT; ++c) size += (rows * columnSizes[c] + 7) / 8 * 8;
+	return size;
+}
+
+// Reads the footer of the append ending at end into footer (previous footer, block offset, row
+// count), if that append is complete: its block ends right at the footer and starts right after the
+// previous append
+bool readFooter(FILE* file, int64_t end, uint64_t footer[3]) {
+	int64_t footerOffset = end - footerSize;
+	uint32_t trailer[2];
+	if(footerOffset < headerSize || !seek(file, footerOffset, SEEK_SET) || fread(footer, sizeof(uint64_t), 3, file) != 3 ||
+		fread(trailer, sizeof(trailer), 1, file) != 1 || trailer[0] != (uint32_t)footerSize || trailer[1] != footerMagic) {
+		return false;
+	}
+	uint64_t blockStart = footer[0] ? footer[0] + footerSize : headerSize;
+	return (!footer[0] || footer[0] >= (uint64_t)headerSize) && footer[1] == blockStart &&
+		footer[1] + getBlockSize(footer[2]) == (uint64_t)footerOffset;
+}
+
+// Reads and checks the header and finds the last complete append.  end gets where it ended, which
+// is 0 for an empty file, and lastFooter the offset of its footer, or 0 if the file has no complete
+// append (it then ends after the header).
+bool readIndex(FILE* file, int64_t& end, int64_t& lastFooter, std::string& error) {
+	if(!seek(file, 0, SEEK_END)) {
+		error = "Could not read results file";
+		return false;
+	}
+	int64_t size = tell(file);
+	end = 0;
+	lastFooter = 0;
+	if(size == 0) return true;
+	uint32_t header[4];
+	if(size < headerSize || !seek(file, 0, SEEK_SET) || fread(header, sizeof(header), 1, file) != 1 || header[0] != headerMagic) {
+		error = "Not a results file";
+		return false;
+	}
+	if(header[1] != formatVersion || header[2] != COLUMN_COUNT || header[3] != (uint32_t)resultsLayoutStride) {
+		error = "Unsupported results file version";
+		return false;
+	}
+
+	// Every append ends 8-byte aligned with a trailer.  Anything after the last valid one is what is
+	// left of an append that did not complete.
+	static const size_t chunkSize = 1 << 16;
+	std::vector<uint32_t> chunk(chunkSize / 4);
+	int64_t chunkEnd = size / 8 * 8;
+	while(chunkEnd > headerSize) {
+		int64_t chunkStart = std::max(chunkEnd - (int64_t)chunkSize, (int64_t)headerSize);
+		size_t length = chunkEnd - chunkStart;
+		if(!seek(file, chunkStart, SEEK_SET) || fread(&chunk[0], 1, length, file) != length) {
+			error = "Could not read results file";
+			return false;
+		}
+		for(size_t pos = length; pos >= trailerSize; pos -= 8) {
+			uint64_t footer[3];
+			if(chunk[pos / 4 - 1] == footerMagic && readFooter(file, chunkStart + pos, footer)) {
+				end = chunkStart + pos;
+				lastFooter = end - footerSize;
+				return true;
+			}
+		}
+		chunkEnd = chunkStart;
+	}
+	end = headerSize;
+	return true;
+}
+
+// Follows the footers back from lastFooter; blocks gets the offset and row count of every block,
+// in file order
+bool readBlocks(FILE* file, int64_t lastFooter, std::vector<uint64_t>& blocks, std::string& error) {
+	blocks.clear();
+	for(int64_t footerOffset = lastFooter; footerOffset; ) {
+		uint64_t footer[3];
+		if(!readFooter(file, footerOffset + footerSize, footer)) {
+			error = "Corrupt results file";
+			return false;
+		}
+		blocks.push_back(footer[2]);
+		blocks.push_back(footer[1]);
+		footerOffset = footer[0];
+	}
+	std::reverse(blocks.begin(), blocks.end());
+	return true;
+}
+
+// Copies size bytes at offset in from to the end of to
+bool copyBytes(FILE* from, uint64_t offset, uint64_t size, FILE* to, std::vector<uint8_t>& buffer) {
+	if(!seek(from, offset, SEEK_SET)) return false;
+	while(size) {
+		size_t length = (size_t)std::min(size, (uint64_t)buffer.size());
+		if(fread(&buffer[0], 1, length, from) != length || fwrite(&buffer[0], 1, length, to) != length) return false;
+		size -= length;
+	}
+	return true;
+}
+
+// Serializes appends and compaction within the process
+std::mutex fileMutex;
+
+}
+
+ResultsFileWriter::ResultsFileWriter() : numRows(0) {
+}
+
+void ResultsFileWriter::add(const std::vector<ComponentType>& types, int width, const SimulationResults& results) {
+	put<uint8_t>(columns[COLUMN_WIDTH], width);
+	std::vector<uint8_t>& layout = columns[COLUMN_LAYOUT];
+	size_t pos = layout.size();
+	layout.resize(pos + resultsLayoutStride, COMPONENT_NONE);
+	for(size_t i = 0; i < types.size() && i < (size_t)resultsLayoutStride; ++i) layout[pos + i] = types[i];
+	put<float>(columns[COLUMN_EFFICIENCY], results.efficiency);
+	put<float>(columns[COLUMN_TOTAL_EU_PER_CYCLE], results.totalEUPerCycle);
+	put<int32_t>(columns[COLUMN_EU_PER_TICK], results.euPerTick);
+	put<int32_t>(columns[COLUMN_OVERALL_EU_PER_TICK], results.overallEUPerTick);
+	put<int32_t>(columns[COLUMN_COOLDOWN_TICKS], results.cooldownTicks);
+	put<int32_t>(columns[COLUMN_CYCLE_TICKS], results.cycleTicks);
+	put<int32_t>(columns[COLUMN_NUM_ITERATIONS_BEFORE_FAILURE], results.numIterationsBeforeFailure);
+	put<int32_t>(columns[COLUMN_TICKS_UNTIL_MELTDOWN], results.ticksUntilMeltdown);
+	put<int32_t>(columns[COLUMN_TICKS_UNTIL_COMPONENT_FAILURE], results.ticksUntilComponentFailure);
+	put<int32_t>(columns[COLUMN_TOTAL_COST], results.totalCost);
+	put<int8_t>(columns[COLUMN_MARK], results.mark);
+	put<uint8_t>(columns[COLUMN_FLAGS], (results.usesSingleUseCoolant ? RESULTS_USES_SINGLE_USE_COOLANT : 0) |
+		(results.timedOut ? RESULTS_TIMED_OUT : 0) | (results.incomplete ? RESULTS_INCOMPLETE : 0));
+	put<uint8_t>(columns[COLUMN_REJECT_REASON], results.rejected);
+	numRows++;
+}
+
+bool ResultsFileWriter::append(const std::string& filename, std::string& error) {
+	std::lock_guard<std::mutex> lock(fileMutex);
+	FILE* file = fopen(filename.c_str(), "r+b");
+	if(!file) file = fopen(filename.c_str(), "w+b");
+	if(!file) {
+		error = "Could not open results file " + filename;
+		return false;
+	}
+	int64_t end, lastFooter;
+	if(!readIndex(file, end, lastFooter, error)) {
+		fclose(file);
+		return false;
+	}
+	bool ok = seek(file, end, SEEK_SET);
+	if(ok && end == 0) {
+		uint32_t header[4] = { headerMagic, formatVersion, COLUMN_COUNT, (uint32_t)resultsLayoutStride };
+		ok = fwrite(header, sizeof(header), 1, file) == 1;
+		end = headerSize;
+	}
+
+	// The new block and its footer go after the last complete append, which is left intact until the
+	// new trailer makes it obsolete
+	uint64_t footer[3] = { (uint64_t)lastFooter, (uint64_t)end, numRows };
+	static const uint8_t padding[8] = { 0 };
+	for(int c = 0; ok && c < COLUMN_COUNT; ++c) {
+		const std::vector<uint8_t>& column = columns[c];
+		if(!column.empty()) ok = fwrite(&column[0], 1, column.size(), file) == column.size();
+		size_t pad = (8 - column.size() % 8) % 8;
+		if(ok && pad) ok = fwrite(padding, 1, pad, file) == pad;
+	}
+	uint32_t trailer[2] = { (uint32_t)footerSize, footerMagic };
+	ok = ok && fwrite(footer, sizeof(footer), 1, file) == 1;
+	// The trailer last, once the rest has been handed to the OS
+	ok = ok && fflush(file) == 0 && fwrite(trailer, sizeof(trailer), 1, file) == 1;
+	if(fclose(file) != 0) ok = false;
+	if(!ok) error = "Could not write results file " + filename;
+	return ok;
+}
+
+bool checkResultsFile(const std::string& filename, std::string& error) {
+	FILE* file = fopen(filename.c_str(), "ab");
+	if(file) {
+		fclose(file);
+		file = fopen(filename.c_str(), "rb");
+	}
+	if(!file) {
+		error = "Could not open results file " + filename;
+		return false;
+	}
+	int64_t end, lastFooter;
+	bool ok = readIndex(file, end, lastFooter, error);
+	fclose(file);
+	return ok;
+}
+
+bool compactResultsFile(const std::string& filename, std::string& error) {
+	std::lock_guard<std::mutex> lock(fileMutex);
+	FILE* file = fopen(filename.c_str(), "rb");
+	if(!file) {
+		error = "Could not open results file " + filename;
+		return false;
+	}
+	int64_t end, lastFooter;
+	std::vector<uint64_t> blocks;
+	if(!readIndex(file, end, lastFooter, error) || !readBlocks(file, lastFooter, blocks, error)) {
+		fclose(file);
+		return false;
+	}
+	if(blocks.size() <= 2) {
+		fclose(file);
+		return true;
+	}
+
+	// Written next to the file and renamed over it, so a crash leaves one or the other
+	std::string tmpFilename = filename + ".compact";
+	FILE* out = fopen(tmpFilename.c_str(), "wb");
+	if(!out) {
+		fclose(file);
+		error = "Could not write results file " + tmpFilename;
+		return false;
+	}
+	uint64_t numRows = 0;
+	std::vector<uint64_t> offsets;	// of the next column in each block
+	for(size_t i = 0; i < blocks.size(); i += 2) {
+		offsets.push_back(blocks[i]);
+		numRows += blocks[i + 1];
+	}
+	uint32_t header[4] = { headerMagic, formatVersion, COLUMN_COUNT, (uint32_t)resultsLayoutStride };
+	bool ok = fwrite(header, sizeof(header), 1, out) == 1;
+	std::vector<uint8_t> buffer(1 << 20);
+	static const uint8_t padding[8] = { 0 };
+	for(int c = 0; ok && c < COLUMN_COUNT; ++c) {
+		uint64_t written = 0;
+		for(size_t b = 0; ok && b < offsets.size(); ++b) {
+			uint64_t size = blocks[b * 2 + 1] * columnSizes[c];
+			ok = copyBytes(file, offsets[b], size, out, buffer);
+			offsets[b] += (size + 7) / 8 * 8;
+			written += size;
+		}
+		size_t pad = (8 - written % 8) % 8;
+		if(ok && pad) ok = fwrite(padding, 1, pad, out) == pad;
+	}
+	uint64_t footer[3] = { 0, (uint64_t)headerSize, numRows };
+	uint32_t trailer[2] = { (uint32_t)footerSize, footerMagic };
+	ok = ok && fwrite(footer, sizeof(footer), 1, out) == 1 && fflush(out) == 0 && fwrite(trailer, sizeof(trailer), 1, out) == 1;
+	fclose(file);
+	if(fclose(out) != 0) ok = false;
+#ifdef _WIN32
+	if(ok) remove(filename.c_str());
+#endif
+	if(!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+		remove(tmpFilename.c_str());
+		error = "Could not write results file " + tmpFilename;
+		return false;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,75 @@
+#ifndef RESULTSFILE_HPP
+#define RESULTSFILE_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "reactorsim.hpp"
+
+namespace reactorsim {
+
+// Columnar results file, little endian, meant to be memory-mapped and read column by column.
+//   header: 'RSRS', version, numColumns, layoutStride (uint32 each)
+//   blocks: one per append; each column of the block's rows in ResultsColumn order, every column
+//           padded to a multiple of 8 bytes
+//   footer: one per append, after its block: offset of the previous append's footer (0 for the
+//           first), offset and row count of the block (uint64 each)
+//   trailer: footer size including the trailer (uint32, 32), 'RSRF'
+// Each append writes its block, footer and trailer after the previous trailer, so the file is read
+// by finding its last valid trailer and following the footers back to the first block.  An append
+// that is cut short loses only its own block.
+enum ResultsColumn {
+	COLUMN_WIDTH,			// uint8
+	COLUMN_LAYOUT,			// uint8 ComponentType per cell, row-major, resultsLayoutStride per row
+	COLUMN_EFFICIENCY,		// float32
+	COLUMN_TOTAL_EU_PER_CYCLE,	// float32
+	COLUMN_EU_PER_TICK,		// int32
+	COLUMN_OVERALL_EU_PER_TICK,	// int32
+	COLUMN_COOLDOWN_TICKS,	// int32
+	COLUMN_CYCLE_TICKS,		// int32
+	COLUMN_NUM_ITERATIONS_BEFORE_FAILURE,	// int32
+	COLUMN_TICKS_UNTIL_MELTDOWN,	// int32
+	COLUMN_TICKS_UNTIL_COMPONENT_FAILURE,	// int32
+	COLUMN_TOTAL_COST,		// int32
+	COLUMN_MARK,			// int8
+	COLUMN_FLAGS,			// uint8 ResultsFlag bits
+	COLUMN_REJECT_REASON,	// uint8 RejectReason
+	COLUMN_COUNT
+};
+
+enum ResultsFlag {
+	RESULTS_USES_SINGLE_USE_COOLANT = 1,
+	RESULTS_TIMED_OUT = 2,
+	RESULTS_INCOMPLETE = 4
+};
+
+static const int resultsLayoutStride = 9 * 6;	// cells of the widest reactor
+
+// Collects rows in columns and appends them to a results file as one block
+class ResultsFileWriter {
+public:
+	ResultsFileWriter();
+
+	void add(const std::vector<ComponentType>& types, int width, const SimulationResults& results);
+	size_t size() const { return numRows; }
+
+	// Creates the file if it does not exist.  Returns false and sets error if it cannot be written or
+	// is not a results file.  Appends from different threads are serialized.
+	bool append(const std::string& filename, std::string& error);
+
+private:
+	std::vector<uint8_t> columns[COLUMN_COUNT];
+	size_t numRows;
+};
+
+// Whether rows can be appended to the file: it is a results file, or does not exist and can be
+// created.  Sets error if not.
+bool checkResultsFile(const std::string& filename, std::string& error);
+
+// Rewrites a results file with its rows in a single block, so that readers get one view per column.
+// Returns false and sets error if it cannot be read or written.
+bool compactResultsFile(const std::string& filename, std::string& error);
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+// Reader for the columnar results files that runSimulationBatch writes with the resultsFile option.
+// The file is memory-mapped and every column is a typed array view on it, so nothing is parsed
+// per row.  See resultsfile.hpp for the format.
+
+var HEADER_MAGIC = 0x53525352;	// "RSRS"
+var FOOTER_MAGIC = 0x46525352;	// "RSRF"
+var VERSION = 2;
+var FOOTER_SIZE = 32;	// including the trailer
+var LAYOUT_STRIDE = 54;
+
+// In file order: name, typed array type, values per row
+var columns = [
+	[ 'width', Uint8Array, 1 ],
+	[ 'layout', Uint8Array, LAYOUT_STRIDE ],
+	[ 'efficiency', Float32Array, 1 ],
+	[ 'totalEUPerCycle', Float32Array, 1 ],
+	[ 'euPerTick', Int32Array, 1 ],
+	[ 'overallEUPerTick', Int32Array, 1 ],
+	[ 'cooldownTicks', Int32Array, 1 ],
+	[ 'cycleTicks', Int32Array, 1 ],
+	[ 'numIterationsBeforeFailure', Int32Array, 1 ],
+	[ 'ticksUntilMeltdown', Int32Array, 1 ],
+	[ 'ticksUntilComponentFailure', Int32Array, 1 ],
+	[ 'totalCost', Int32Array, 1 ],
+	[ 'mark', Int8Array, 1 ],
+	[ 'flags', Uint8Array, 1 ],
+	[ 'rejectReason', Uint8Array, 1 ]
+];
+
+var FLAG_USES_SINGLE_USE_COOLANT = 1;
+var FLAG_TIMED_OUT = 2;
+var FLAG_INCOMPLETE = 4;
+var rejectReasonNames = [ 'none', 'euPerTick', 'overallEUPerTick', 'mark' ];
+
+// A results file as blocks of column views:
+// - count: Number of rows
+// - blocks: { start, count, columns }, one per append, where columns has a typed array per column
+//   name.  layout holds 54 ComponentType bytes per row, of which the first width * 6 are used.
+// - column(name): The column over every row.  A view on the file if it has one block (see
+//   compactResultsFile()), otherwise a copy of the blocks' columns (made once).
+// - layoutAt(index), resultsAt(index): One row as component codes, or as a results object like
+//   runSimulationBatch() returns
+function ResultsFile(buffer, codes) {
+	this.buffer = buffer;
+	this.count = 0;
+	this.blocks = [];
+	this._codes = codes;
+	this._columns = {};
+	if(buffer.byteLength === 0) return;
+	var view = new DataView(buffer);
+	var size = buffer.byteLength;
+	if(size < 16 || view.getUint32(0, true) !== HEADER_MAGIC) {
+		throw new Error('Not a results file');
+	}
+	if(view.getUint32(4, true) !== VERSION || view.getUint32(8, true) !== columns.length || view.getUint32(12, true) !== LAYOUT_STRIDE) {
+		throw new Error('Unsupported results file version');
+	}
+	// Every append ends with a trailer; anything after the last valid one is left from an append
+	// that did not complete.  Its footer links back to the footers of the earlier appends.
+	var footer = null;
+	for(var end = Math.floor(size / 8) * 8; end >= 16 + FOOTER_SIZE && !footer; end -= 8) {
+		if(view.getUint32(end - 4, true) === FOOTER_MAGIC) footer = readFooter(view, end);
+	}
+	var index = [];
+	while(footer) {
+		index.push([ footer.offset, footer.count ]);
+		if(!footer.previous) break;
+		var previous = readFooter(view, footer.previous + FOOTER_SIZE);
+		if(!previous) throw new Error('Corrupt results file');
+		footer = previous;
+	}
+	index.reverse().forEach(function(entry) {
+		var offset = entry[0];
+		var count = entry[1];
+		var block = { start: this.count, count: count, columns: {} };
+		columns.forEach(function(column) {
+			var length = count * column[2];
+			block.columns[column[0]] = new column[1](buffer, offset, length);
+			offset += blockColumnSize(column, count);
+		});
+		this.blocks.push(block);
+		this.count += count;
+	}, this);
+}
+
+function blockColumnSize(column, count) {
+	return Math.ceil(count * column[2] * column[1].BYTES_PER_ELEMENT / 8) * 8;
+}
+
+// { previous, offset, count } of the append ending at end, or null unless it is complete: its block
+// ends right at the footer and starts right after the previous append
+function readFooter(view, end) {
+	var footer = end - FOOTER_SIZE;
+	if(footer < 16 || view.getUint32(end - 8, true) !== FOOTER_SIZE || view.getUint32(end - 4, true) !== FOOTER_MAGIC) return null;
+	var previous = Number(view.getBigUint64(footer, true));
+	var offset = Number(view.getBigUint64(footer + 8, true));
+	var count = Number(view.getBigUint64(footer + 16, true));
+	if(previous && previous < 16 || offset !== (previous ? previous + FOOTER_SIZE : 16)) return null;
+	var blockEnd = offset;
+	for(var c = 0; c < columns.length; c++) blockEnd += blockColumnSize(columns[c], count);
+	return blockEnd === footer ? { previous: previous, offset: offset, count: count } : null;
+}
+
+ResultsFile.prototype.column = function(name) {
+	if(this._columns[name]) return this._columns[name];
+	var spec = columns.filter(function(column) { return column[0] === name; })[0];
+	if(!spec) throw new Error('Unknown column: ' + name);
+	var result;
+	if(this.blocks.length === 1) {
+		result = this.blocks[0].columns[name];
+	} else {
+		result = new spec[1](this.count * spec[2]);
+		this.blocks.forEach(function(block) {
+			result.set(block.columns[name], block.start * spec[2]);
+		});
+	}
+	this._columns[name] = result;
+	return result;
+};
+
+ResultsFile.prototype.layoutAt = function(index) {
+	var width = this.column('width')[index];
+	var cells = this.column('layout').subarray(index * LAYOUT_STRIDE, index * LAYOUT_STRIDE + width * 6);
+	var codes = this._codes;
+	return Array.prototype.map.call(cells, function(type) { return codes[type]; });
+};
+
+ResultsFile.prototype.resultsAt = function(index) {
+	var self = this;
+	var results = {};
+	[ 'efficiency', 'totalEUPerCycle', 'euPerTick', 'overallEUPerTick' ].forEach(function(name) {
+		results[name] = self.column(name)[index];
+	});
+	var flags = this.column('flags')[index];
+	results.usesSingleUseCoolant = !!(flags & FLAG_USES_SINGLE_USE_COOLANT);
+	results.timedOut = !!(flags & FLAG_TIMED_OUT);
+	[ 'cooldownTicks', 'cycleTicks', 'mark', 'numIterationsBeforeFailure', 'ticksUntilMeltdown', 'ticksUntilComponentFailure', 'totalCost' ].forEach(function(name) {
+		results[name] = self.column(name)[index];
+	});
+	results.incomplete = !!(flags & FLAG_INCOMPLETE);
+	var rejectReason = this.column('rejectReason')[index];
+	results.rejected = rejectReason !== 0;
+	if(rejectReason) results.rejectReason = rejectReasonNames[rejectReason];
+	return results;
+};
+
+function readResultsFile(reactorsim, codes, filename) {
+	return new ResultsFile(reactorsim.mapResultsFile(filename), codes);
+}
+
+exports.ResultsFile = ResultsFile;
+exports.readResultsFile = readResultsFile;
+exports.columns = columns.map(function(column) { return column[0]; });
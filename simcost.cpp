@@ -0,0 +1,197 @@
+#include "simcost.hpp"
+#include "simstats.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace reactorsim {
+
+namespace {
+
+bool isFuel(ComponentType type) {
+	return type == URANIUM_CELL || type == DUAL_URANIUM_CELL || type == QUAD_URANIUM_CELL;
+}
+
+bool isReflector(ComponentType type) {
+	return type == NEUTRON_REFLECTOR || type == THICK_NEUTRON_REFLECTOR;
+}
+
+bool isExchanger(ComponentType type) {
+	return type == HEAT_EXCHANGER || type == ADVANCED_HEAT_EXCHANGER || type == CORE_HEAT_EXCHANGER || type == COMPONENT_HEAT_EXCHANGER;
+}
+
+// Cells of the four neighbours, or -1 off the grid or where there is no component
+void getNeighbours(Reactor& reactor, int cell, int* neighbours) {
+	int x = cell % reactor.width;
+	int y = cell / reactor.width;
+	neighbours[0] = reactor.left(x, y) ? cell - 1 : -1;
+	neighbours[1] = reactor.right(x, y) ? cell + 1 : -1;
+	neighbours[2] = reactor.above(x, y) ? cell - reactor.width : -1;
+	neighbours[3] = reactor.below(x, y) ? cell + reactor.width : -1;
+}
+
+// Spreads heat evenly over the neighbours that store heat, apart from `except`.  Returns false if
+// there are none.
+bool spreadHeat(Reactor& reactor, int cell, int heat, int except, std::vector<int>& heatIn) {
+	int neighbours[4];
+	getNeighbours(reactor, cell, neighbours);
+	int acceptors[4];
+	int numAcceptors = 0;
+	for(int n : neighbours) {
+		if(n >= 0 && n != except && reactor.components[n]->canStoreHeat()) acceptors[numAcceptors++] = n;
+	}
+	for(int i = 0; i < numAcceptors; ++i) {
+		int share = heat / (numAcceptors - i);
+		heat -= share;
+		heatIn[acceptors[i]] += share;
+	}
+	return numAcceptors > 0;
+}
+
+}
+
+CostFeatures getCostFeatures(Reactor& reactor) {
+	CostFeatures features;
+	int numCells = reactor.components.size();
+	std::vector<int> heatIn(numCells, 0);
+	std::vector<int> heatOut(numCells, 0);
+	int hullIn = 0;
+	int& hullDrain = features.hullVentCapacity;
+	int& hullCapacity = features.hullCapacity;
+	hullCapacity = 10000;
+	int condensatorCapacity = 0;
+
+	// Where the fuel's heat goes, and what removes it
+	for(int i = 0; i < numCells; ++i) {
+		ReactorComponent* comp = reactor.components[i].get();
+		if(!comp) continue;
+		ComponentType type = comp->type;
+		if(isFuel(type)) {
+			int cells = static_cast<UraniumCell*>(comp)->numCells;
+			int pulses = 1 + cells / 2;
+			int neighbours[4];
+			getNeighbours(reactor, i, neighbours);
+			for(int n : neighbours) {
+				if(n >= 0 && (isFuel(reactor.components[n]->type) || isReflector(reactor.components[n]->type))) pulses++;
+			}
+			int heat = cells * pulses * (pulses + 1) / 2 * 4;
+			features.numFuelCells += cells;
+			features.euPerTick += cells * pulses * UraniumCell::euPerPulse;
+			features.heatPerTick += heat;
+			if(!spreadHeat(reactor, i, heat, -1, heatIn)) hullIn += heat;
+		} else if(type == COMPONENT_HEAT_VENT) {
+			int neighbours[4];
+			getNeighbours(reactor, i, neighbours);
+			for(int n : neighbours) {
+				if(n >= 0 && reactor.components[n]->canStoreHeat()) {
+					heatOut[n] += static_cast<ComponentHeatVent*>(comp)->heatFromEach;
+					features.ventCapacity += static_cast<ComponentHeatVent*>(comp)->heatFromEach;
+				}
+			}
+		} else if(type == HEAT_VENT || type == REACTOR_HEAT_VENT || type == ADVANCED_HEAT_VENT || type == OVERCLOCKED_HEAT_VENT) {
+			heatOut[i] += static_cast<HeatVent*>(comp)->heatDissipated;
+			features.ventCapacity += static_cast<HeatVent*>(comp)->heatDissipated;
+			hullDrain += static_cast<HeatVent*>(comp)->heatFromReactor;
+		} else if(isExchanger(type)) {
+			features.hasExchangers = true;
+		} else if(type == CONDENSATOR_RSH || type == CONDENSATOR_LZH) {
+			features.hasCondensators = true;
+			condensatorCapacity += comp->getMaxHeat();
+		} else if(type == REACTOR_PLATING || type == CONTAINMENT_REACTOR_PLATING || type == HEAT_CAPACITY_REACTOR_PLATING) {
+			hullCapacity += static_cast<ReactorPlating*>(comp)->heatAddition;
+		}
+		if(comp->canStoreHeat()) features.heatCapacity += comp->getMaxHeat();
+	}
+	features.heatCapacity += hullCapacity;
+
+	// Vents that take heat from the hull share what reaches it
+	if(hullDrain > 0) {
+		int drained = std::min(hullIn, hullDrain);
+		for(int i = 0; i < numCells; ++i) {
+			ReactorComponent* comp = reactor.components[i].get();
+			if(comp && (comp->type == REACTOR_HEAT_VENT || comp->type == OVERCLOCKED_HEAT_VENT)) {
+				heatIn[i] += (int)((int64_t)drained * static_cast<HeatVent*>(comp)->heatFromReactor / hullDrain);
+			}
+		}
+		hullIn -= drained;
+	}
+
+	// Exchangers pass their heat on to the neighbours that store heat
+	for(int i = 0; i < numCells; ++i) {
+		ReactorComponent* comp = reactor.components[i].get();
+		if(comp && isExchanger(comp->type) && heatIn[i] > 0 && spreadHeat(reactor, i, heatIn[i], -1, heatIn)) heatIn[i] = 0;
+	}
+
+	// Condensators fill up before the heat they take goes to the hull, so they count as hull capacity
+	int hullNet = hullIn;
+	int firstFailure = 0;
+	for(int i = 0; i < numCells; ++i) {
+		ReactorComponent* comp = reactor.components[i].get();
+		int net = heatIn[i] - heatOut[i];
+		if(!comp || net <= 0) continue;
+		features.heatLeftPerTick += net;
+		if(comp->type == CONDENSATOR_RSH || comp->type == CONDENSATOR_LZH) {
+			hullNet += net;
+		} else {
+			int ticks = comp->getMaxHeat() / net + 1;
+			if(!firstFailure || ticks < firstFailure) firstFailure = ticks;
+		}
+	}
+	features.heatLeftPerTick += hullIn;
+	features.hullHeatLeftPerTick = hullIn;
+	if(hullNet > 0) {
+		int ticks = (hullCapacity + condensatorCapacity) / hullNet + 1;
+		if(!firstFailure || ticks < firstFailure) {
+			firstFailure = ticks;
+			features.meltsDownFirst = true;
+		}
+	}
+	features.ticksUntilFailure = firstFailure;
+	return features;
+}
+
+int estimateSimulationTicks(Reactor& reactor, const SimulationOptions& options) {
+	CostFeatures features = getCostFeatures(reactor);
+	if(!features.numFuelCells) return 0;
+	const SimulationThresholds& thresholds = options.thresholds;
+	bool fails = features.ticksUntilFailure && features.ticksUntilFailure < Reactor::fuelTicks;
+	int firstRun = fails ? features.ticksUntilFailure : Reactor::fuelTicks;
+	// Rejected as soon as the first run is over
+	if(features.euPerTick < thresholds.minEUPerTick || features.euPerTick < thresholds.minOverallEUPerTick) return firstRun;
+	if(fails && thresholds.maxMark < 3) return firstRun;
+
+	// Cooldowns stop once the total heat stops falling, so heat left in the hull only counts if vents
+	// take it from there
+	int64_t componentHeat = std::min((int64_t)(features.heatLeftPerTick - features.hullHeatLeftPerTick) * firstRun, (int64_t)(features.heatCapacity - features.hullCapacity));
+	int64_t hullHeat = std::min((int64_t)features.hullHeatLeftPerTick * firstRun, (int64_t)features.hullCapacity);
+	int64_t cooldown = 16;
+	if(features.ventCapacity) cooldown = std::max(cooldown, componentHeat / features.ventCapacity);
+	if(features.hullVentCapacity) cooldown = std::max(cooldown, hullHeat / features.hullVentCapacity);
+	cooldown = std::min(cooldown, (int64_t)(Reactor::timeoutTicks - firstRun));
+
+	if(fails) {
+		if(features.meltsDownFirst) return firstRun + (int)cooldown;
+		// After a component failure the run goes on without it, with its heat going elsewhere, until the
+		// hull melts or the fuel is used
+		int unvented = std::max(features.heatPerTick - features.ventCapacity, 1);
+		int untilMeltdown = features.hullCapacity / unvented;
+		return firstRun + (int)cooldown + std::min(untilMeltdown, Reactor::fuelTicks - firstRun);
+	}
+	if(!features.heatLeftPerTick && !features.hasExchangers && !features.hasCondensators) {
+		return Reactor::fuelTicks;	// cold after the run
+	}
+	// A cooldown and a rerun, or with exactCycles usually a few cycles before they are proven to repeat
+	int reruns = options.exactCycles ? std::min(options.maxCycles, 3) : 1;
+	return Reactor::fuelTicks + (int)cooldown + reruns * Reactor::fuelTicks;
+}
+
+void recordCostEstimate(int predictedTicks, uint64_t actualTicks) {
+	statIncrement(STAT_ESTIMATED_SIMULATIONS);
+	statAdd(STAT_PREDICTED_TICKS, predictedTicks);
+	statAdd(STAT_ESTIMATED_ACTUAL_TICKS, actualTicks);
+	// log2(actual / predicted), rounded and clamped, with a tick added to both so zeros count
+	int bucket = (int)std::lround(std::log2((double)(actualTicks + 1) / (double)(predictedTicks + 1)));
+	bucket = std::max(-numCostRatioBuckets / 2, std::min(numCostRatioBuckets / 2, bucket));
+	statIncrement(STAT_COST_RATIO + bucket + numCostRatioBuckets / 2);
+}
+
+}
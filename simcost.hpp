@@ -0,0 +1,37 @@
+#ifndef SIMCOST_HPP
+#define SIMCOST_HPP
+
+#include "reactorsim.hpp"
+
+namespace reactorsim {
+
+// Static features of a layout, read from its components without simulating
+struct CostFeatures {
+	int numFuelCells = 0;
+	int euPerTick = 0;			// with every cell pulsing
+	int heatPerTick = 0;		// produced by the fuel
+	int ventCapacity = 0;		// heat vents and component heat vents can dissipate per tick
+	int hullVentCapacity = 0;	// of that, heat vents can take from the hull
+	int heatCapacity = 0;		// of the hull and every component that stores heat
+	int hullCapacity = 0;
+	int heatLeftPerTick = 0;	// heat that stays in components and the hull, where it is not vented
+	int hullHeatLeftPerTick = 0;	// of that, heat that stays in the hull
+	int ticksUntilFailure = 0;	// until the first component fills up or the hull melts; 0 if never
+	bool meltsDownFirst = false;	// the hull fills up before any component
+	bool hasExchangers = false;
+	bool hasCondensators = false;
+};
+
+CostFeatures getCostFeatures(Reactor& reactor);
+
+// Predicts how many ticks runSimulation() will simulate for the layout, from its static features.
+// Only meant to order work, so it is rough: it follows the branches runSimulation() takes, with
+// heat spread evenly and exchangers passing their heat straight on.
+int estimateSimulationTicks(Reactor& reactor, const SimulationOptions& options = SimulationOptions());
+
+// Adds a prediction and the ticks actually simulated to the cost model stats
+void recordCostEstimate(int predictedTicks, uint64_t actualTicks);
+
+}
+
+#endif
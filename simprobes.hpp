@@ -0,0 +1,60 @@
+#ifndef SIMPROBES_HPP
+#define SIMPROBES_HPP
+
+// USDT probes (provider "reactorsim") for perf, bpftrace and SystemTap.  A probe compiles to a
+// single nop until a tracer attaches to it.  They are built in on Linux when <sys/sdt.h> (from
+// systemtap-sdt-dev) is available; define REACTORSIM_NO_USDT to leave them out.  Each probe has a
+// semaphore that tracers raise while attached, so SIM_PROBE_ENABLED() can skip computing arguments
+// nobody reads.
+//
+// simulation__start(layoutHash, width, numUraniumCells)
+// simulation__done(layoutHash, mark, euPerTick, numIterationsBeforeFailure, incomplete)
+// rununtil(stopReason, ticks)
+// component__destroyed(cell, componentType, tick)
+// meltdown(tick, reactorHeat)
+// queue__enqueue(job)
+// queue__dequeue(job, waitNanos)
+
+#if !defined(REACTORSIM_NO_USDT) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define REACTORSIM_USDT 1
+#endif
+#endif
+
+// Every probe, since with semaphores each one needs its own
+#define SIM_PROBES(X) X(simulation__start) X(simulation__done) X(rununtil) X(component__destroyed) X(meltdown) \
+	X(queue__enqueue) X(queue__dequeue)
+
+#ifdef REACTORSIM_USDT
+// Declares and, in reactorsim.cpp, defines the semaphores
+#define SIM_PROBE_SEMAPHORE(name) extern "C" volatile unsigned short reactorsim_##name##_semaphore;
+#define SIM_PROBE_SEMAPHORE_DEFINITION(name) \
+	extern "C" { volatile unsigned short reactorsim_##name##_semaphore __attribute__((section(".probes"))) = 0; }
+SIM_PROBES(SIM_PROBE_SEMAPHORE)
+
+#define SIM_PROBE_ENABLED(name) (reactorsim_##name##_semaphore != 0)
+#define SIM_PROBE1(name, a) DTRACE_PROBE1(reactorsim, name, a)
+#define SIM_PROBE2(name, a, b) DTRACE_PROBE2(reactorsim, name, a, b)
+#define SIM_PROBE3(name, a, b, c) DTRACE_PROBE3(reactorsim, name, a, b, c)
+#define SIM_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(reactorsim, name, a, b, c, d, e)
+#else
+#define SIM_PROBE_ENABLED(name) false
+#define SIM_PROBE1(name, a) do {} while(0)
+#define SIM_PROBE2(name, a, b) do {} while(0)
+#define SIM_PROBE3(name, a, b, c) do {} while(0)
+#define SIM_PROBE5(name, a, b, c, d, e) do {} while(0)
+#endif
+
+namespace reactorsim {
+
+#ifdef REACTORSIM_USDT
+static const bool usdtCompiledIn = true;
+#else
+static const bool usdtCompiledIn = false;
+#endif
+
+}
+
+#endif
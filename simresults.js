@@ -0,0 +1,100 @@
+// Results objects of runSimulation(), runSimulationSync() and runSimulationBatch().  Instead of
+// setting a property per field through N-API, the addon writes the fields of every simulation it
+// delivers at once into one Float64Array and calls createResults() for each, which builds the
+// plain object in JS.  The objects copy their fields and do not keep the array alive.  Batches can
+// instead be called back with the array itself; see ResultColumns.
+
+var rejectReasonNames = [ 'none', 'euPerTick', 'overallEUPerTick', 'mark' ];
+var cancelReasonNames = [ 'none', 'cancelled', 'tickBudget', 'deadline' ];
+
+// Slot layout; must match ResultSlot in node-reactorsim.cpp
+var SLOT_SIZE = 18;
+var REJECT_REASON = 14;
+var INCOMPLETE_REASON = 15;
+var PREDICTED_TICKS = 16;
+var SIMULATED_TICKS = 17;
+
+// Fields are in the order the addon sets them on plain results objects; optional ones are only set
+// when they apply
+function createResults(values, index) {
+	var slot = index * SLOT_SIZE;
+	var results = {
+		efficiency: values[slot],
+		totalEUPerCycle: values[slot + 1],
+		euPerTick: values[slot + 2],
+		overallEUPerTick: values[slot + 3],
+		usesSingleUseCoolant: values[slot + 4] !== 0,
+		timedOut: values[slot + 5] !== 0,
+		cooldownTicks: values[slot + 6],
+		cycleTicks: values[slot + 7],
+		mark: values[slot + 8],
+		numIterationsBeforeFailure: values[slot + 9],
+		ticksUntilMeltdown: values[slot + 10],
+		ticksUntilComponentFailure: values[slot + 11],
+		totalCost: values[slot + 12],
+		incomplete: values[slot + 13] !== 0,
+		rejected: values[slot + REJECT_REASON] !== 0
+	};
+	if(results.rejected) results.rejectReason = rejectReasonNames[values[slot + REJECT_REASON]];
+	if(values[slot + INCOMPLETE_REASON] >= 0) results.incompleteReason = cancelReasonNames[values[slot + INCOMPLETE_REASON]];
+	if(values[slot + PREDICTED_TICKS] >= 0) {
+		results.predictedTicks = values[slot + PREDICTED_TICKS];
+		results.simulatedTicks = values[slot + SIMULATED_TICKS];
+	}
+	return results;
+}
+
+// Results of a runSimulationBatch() or runSimulationStates() call made with results: 'columns': the
+// Float64Array the addon wrote them to, SLOT_SIZE values per simulation in batch order, read through
+// accessors that take the index in the batch, such as results.mark(i).  No object is created per
+// result; toObject(i) builds the plain object for one that is kept.
+function ResultColumns(values) {
+	this.values = values;
+	this.length = values.length / SLOT_SIZE;
+}
+
+// Slot offsets of the numeric fields
+var numberSlots = {
+	efficiency: 0, totalEUPerCycle: 1, euPerTick: 2, overallEUPerTick: 3,
+	cooldownTicks: 6, cycleTicks: 7, mark: 8, numIterationsBeforeFailure: 9,
+	ticksUntilMeltdown: 10, ticksUntilComponentFailure: 11, totalCost: 12
+};
+var booleanSlots = { usesSingleUseCoolant: 4, timedOut: 5, incomplete: 13, rejected: REJECT_REASON };
+
+Object.keys(numberSlots).forEach(function(name) {
+	var offset = numberSlots[name];
+	ResultColumns.prototype[name] = function(index) {
+		return this.values[index * SLOT_SIZE + offset];
+	};
+});
+Object.keys(booleanSlots).forEach(function(name) {
+	var offset = booleanSlots[name];
+	ResultColumns.prototype[name] = function(index) {
+		return this.values[index * SLOT_SIZE + offset] !== 0;
+	};
+});
+
+// undefined where the plain object has no such property
+ResultColumns.prototype.rejectReason = function(index) {
+	var reason = this.values[index * SLOT_SIZE + REJECT_REASON];
+	return reason !== 0 ? rejectReasonNames[reason] : undefined;
+};
+ResultColumns.prototype.incompleteReason = function(index) {
+	var reason = this.values[index * SLOT_SIZE + INCOMPLETE_REASON];
+	return reason >= 0 ? cancelReasonNames[reason] : undefined;
+};
+ResultColumns.prototype.predictedTicks = function(index) {
+	var ticks = this.values[index * SLOT_SIZE + PREDICTED_TICKS];
+	return ticks >= 0 ? ticks : undefined;
+};
+ResultColumns.prototype.simulatedTicks = function(index) {
+	return this.values[index * SLOT_SIZE + PREDICTED_TICKS] >= 0 ? this.values[index * SLOT_SIZE + SIMULATED_TICKS] : undefined;
+};
+
+ResultColumns.prototype.toObject = function(index) {
+	return createResults(this.values, index);
+};
+
+exports.createResults = createResults;
+exports.ResultColumns = ResultColumns;
+exports.SLOT_SIZE = SLOT_SIZE;
@@ -0,0 +1,56 @@
+#include "simstats.hpp"
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace reactorsim {
+
+StatBlock::StatBlock() {
+	for(int i = 0; i < STAT_COUNT; ++i) values[i].store(0, std::memory_order_relaxed);
+}
+
+namespace {
+
+std::mutex registryMutex;
+std::vector<StatBlock*> liveBlocks;
+StatsSnapshot retired = {};
+
+// Registers the thread's block on first use, and folds it into `retired` when the thread exits
+struct ThreadStatBlock {
+	StatBlock block;
+	ThreadStatBlock() {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		liveBlocks.push_back(&block);
+	}
+	~ThreadStatBlock() {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		for(int i = 0; i < STAT_COUNT; ++i) retired.values[i] += block.values[i].load(std::memory_order_relaxed);
+		liveBlocks.erase(std::remove(liveBlocks.begin(), liveBlocks.end(), &block), liveBlocks.end());
+	}
+};
+
+}
+
+StatBlock& threadStats() {
+	static thread_local ThreadStatBlock tsb;
+	return tsb.block;
+}
+
+StatsSnapshot collectStats() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	StatsSnapshot snap = retired;
+	for(StatBlock* block : liveBlocks) {
+		for(int i = 0; i < STAT_COUNT; ++i) snap.values[i] += block->values[i].load(std::memory_order_relaxed);
+	}
+	return snap;
+}
+
+void resetStats() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	retired = StatsSnapshot();
+	for(StatBlock* block : liveBlocks) {
+		for(int i = 0; i < STAT_COUNT; ++i) block->values[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+}
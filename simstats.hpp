@@ -0,0 +1,118 @@
+#ifndef SIMSTATS_HPP
+#define SIMSTATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace reactorsim {
+
+// Which top-level path runSimulation() took
+enum SimBranch {
+	BRANCH_NO_FUEL,
+	BRANCH_COMPONENT_FAILED,	// first run stopped on component failure (mark III-V)
+	BRANCH_MELTDOWN,			// first run stopped on meltdown (mark III or V)
+	BRANCH_COLD_AFTER_RUN,		// fuel used with no heat left (mark I, no rerun)
+	BRANCH_RERUN,				// fuel used with heat left; cooldown and rerun (mark I or II)
+	BRANCH_COUNT
+};
+
+// Timed sections of runSimulation(), one per reactor it runs
+enum StatPhase {
+	STAT_PHASE_FIRST_RUN,
+	STAT_PHASE_COOLDOWN,
+	STAT_PHASE_RUN_UNTIL_FINISH,
+	STAT_PHASE_RERUN,
+	STAT_PHASE_COUNT
+};
+
+static const int numStopReasons = 6;	// size of RunUntilStopReason
+static const int numMarks = 6;
+static const int numLanes = 2;	// priority lanes of the addon
+static const int numCostRatioBuckets = 9;	// log2(actual / predicted ticks) from -4 to 4
+
+// Counters are stored in one flat array; the ones with a suffix comment are the base of a range
+enum StatCounter {
+	STAT_SIMULATIONS,
+	STAT_RUN_UNTIL_CALLS,	// + RunUntilStopReason
+	STAT_TICKS = STAT_RUN_UNTIL_CALLS + numStopReasons,	// + RunUntilStopReason
+	STAT_BRANCH = STAT_TICKS + numStopReasons,	// + SimBranch
+	STAT_MARK = STAT_BRANCH + BRANCH_COUNT,	// + mark
+	STAT_PHASE_NANOS = STAT_MARK + numMarks,	// + StatPhase
+	STAT_TIMED_OUT_COOLDOWNS = STAT_PHASE_NANOS + STAT_PHASE_COUNT,
+	STAT_REACTOR_COPIES,
+	STAT_COMPONENT_ALLOCATIONS,
+	STAT_QUEUED_JOBS,
+	STAT_QUEUE_WAIT_NANOS,
+	STAT_LANE_JOBS,	// + lane
+	STAT_LANE_WAIT_NANOS = STAT_LANE_JOBS + numLanes,	// + lane
+	STAT_CYCLES_SIMULATED = STAT_LANE_WAIT_NANOS + numLanes,	// fuel cycles simulated by the exact multi-cycle analysis
+	STAT_CYCLES_SKIPPED,	// fuel cycles it proved identical up to a heat offset and skipped
+	STAT_INCOMPLETE_SIMULATIONS,	// stopped by a cancellation token
+	STAT_REJECTED_SIMULATIONS,	// failed an acceptance threshold
+	STAT_CANCELLED_QUEUED_JOBS,	// removed from the thread pool queue before starting
+	STAT_COALESCED_SIMULATIONS,	// requests served by an identical simulation already in flight
+	STAT_SYNC_SIMULATIONS,		// runSimulationSync() calls that finished inline
+	STAT_SYNC_FALLBACKS,		// runSimulationSync() calls that hit the tick cap and were queued
+	STAT_DELIVERY_FLUSHES,		// times completed simulations were delivered to their callbacks together
+	STAT_DELIVERED_SIMULATIONS,	// simulations delivered by them
+	STAT_ESTIMATED_SIMULATIONS,	// queued simulations whose cost was estimated before they ran
+	STAT_PREDICTED_TICKS,		// their estimates, summed
+	STAT_ESTIMATED_ACTUAL_TICKS,	// the ticks they simulated, summed
+	STAT_COST_RATIO,	// + log2(actual / predicted ticks) + numCostRatioBuckets / 2
+	STAT_COUNT = STAT_COST_RATIO + numCostRatioBuckets
+};
+
+// One block per thread.  Only the owning thread adds to it; other threads read it when aggregating
+// and zero it on reset, which is why the counters are (relaxed) atomics.
+struct StatBlock {
+	std::atomic<uint64_t> values[STAT_COUNT];
+	StatBlock();
+};
+
+struct StatsSnapshot {
+	uint64_t values[STAT_COUNT];
+};
+
+StatBlock& threadStats();
+
+inline void statAdd(StatCounter counter, uint64_t n) {
+	threadStats().values[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void statIncrement(StatCounter counter) {
+	statAdd(counter, 1);
+}
+
+// For counters computed as a range base plus an offset
+inline void statAdd(int counter, uint64_t n) {
+	statAdd((StatCounter)counter, n);
+}
+
+inline void statIncrement(int counter) {
+	statAdd((StatCounter)counter, 1);
+}
+
+// Sums the blocks of all live threads plus those of threads that have exited
+StatsSnapshot collectStats();
+void resetStats();
+
+// Adds the time from construction until stop() (or destruction) to a phase timer
+class StatPhaseTimer {
+public:
+	StatPhaseTimer(StatPhase phase) : phase(phase), running(true), start(std::chrono::steady_clock::now()) {}
+	~StatPhaseTimer() { stop(); }
+	void stop() {
+		if(!running) return;
+		running = false;
+		statAdd(STAT_PHASE_NANOS + phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+private:
+	StatPhase phase;
+	bool running;
+	std::chrono::steady_clock::time_point start;
+};
+
+}
+
+#endif
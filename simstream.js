@@ -0,0 +1,119 @@
+var stream = require('stream');
+var util = require('util');
+
+// An object-mode Duplex that simulates the layouts written to it and reads back as
+// { index, id, results } objects.  A layout is written either as an array of component codes or as
+// { id: anything, layout: array }; index counts the layouts written.
+//
+// Options:
+// - window: Maximum number of layouts submitted but not yet read back (default 16).  Writes wait
+//   while the window is full, so producers piping into the stream are throttled.
+// - ordered: Read results in the order layouts were written (default true).  Otherwise they are
+//   read in completion order, and index/id tell them apart.
+// - simulation: Options passed to runSimulation for every layout.  priority defaults to 'bulk'.
+function SimulationStream(reactorsim, options) {
+	options = options || {};
+	this._window = options.window || 16;
+	stream.Duplex.call(this, {
+		objectMode: true,
+		writableHighWaterMark: 1,
+		readableHighWaterMark: this._window
+	});
+	this._reactorsim = reactorsim;
+	this._ordered = options.ordered !== false;
+	this._simOptions = Object.assign({ priority: 'bulk' }, options.simulation);
+	this._nextIndex = 0;
+	this._nextEmit = 0;		// next index to push in ordered mode
+	this._outstanding = 0;	// written but not yet pushed
+	this._completed = {};	// by index; results waiting for earlier ones in ordered mode
+	this._handles = {};		// by index; simulations in flight
+	this._readableFull = false;
+	this._pendingWrite = null;
+	this._pendingFinal = null;
+}
+util.inherits(SimulationStream, stream.Duplex);
+
+SimulationStream.prototype._write = function(chunk, encoding, callback) {
+	var self = this;
+	var index = this._nextIndex;
+	var layout = Array.isArray(chunk) ? chunk : chunk.layout;
+	var id = Array.isArray(chunk) ? undefined : chunk.id;
+	try {
+		this._handles[index] = this._reactorsim.runSimulation(layout, this._simOptions, function(error, results) {
+			self._complete({ index: index, id: id, results: results }, error);
+		});
+	} catch (e) {
+		return callback(e);
+	}
+	this._nextIndex++;
+	this._outstanding++;
+	this._pendingWrite = callback;
+	this._checkWindow();
+};
+
+SimulationStream.prototype._complete = function(output, error) {
+	delete this._handles[output.index];
+	if(this.destroyed) return;
+	if(error) return this.destroy(error);
+	if(this._ordered) {
+		this._completed[output.index] = output;
+		while(this._completed[this._nextEmit]) {
+			var next = this._completed[this._nextEmit];
+			delete this._completed[this._nextEmit];
+			this._nextEmit++;
+			this._emit(next);
+		}
+	} else {
+		this._emit(output);
+	}
+	this._checkWindow();
+};
+
+SimulationStream.prototype._emit = function(output) {
+	this._outstanding--;
+	if(!this.push(output)) this._readableFull = true;
+};
+
+// Accepts the next write once there is room in the window and the reader is keeping up, and
+// finishes once everything written has been read back
+SimulationStream.prototype._checkWindow = function() {
+	if(this._pendingWrite && this._outstanding < this._window && !this._readableFull) {
+		var callback = this._pendingWrite;
+		this._pendingWrite = null;
+		callback();
+	}
+	if(this._pendingFinal && this._outstanding === 0) {
+		var finalCallback = this._pendingFinal;
+		this._pendingFinal = null;
+		this.push(null);
+		finalCallback();
+	}
+};
+
+SimulationStream.prototype._read = function() {
+	this._readableFull = false;
+	this._checkWindow();
+};
+
+SimulationStream.prototype._final = function(callback) {
+	this._pendingFinal = callback;
+	this._checkWindow();
+};
+
+SimulationStream.prototype._destroy = function(error, callback) {
+	for(var index in this._handles) {
+		this._handles[index].cancel();
+	}
+	this._handles = {};
+	callback(error);
+};
+
+exports.SimulationStream = SimulationStream;
+
+// Simulates the layouts of any iterable or async iterable (such as a generator) and returns the
+// SimulationStream, which can be consumed with for await...of
+exports.simulateAll = function(reactorsim, layouts, options) {
+	var simStream = new SimulationStream(reactorsim, options);
+	stream.pipeline(stream.Readable.from(layouts), simStream, function() {});
+	return simStream;
+};
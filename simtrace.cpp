@@ -0,0 +1,109 @@
+#include "simtrace.hpp"
+#include "reactorsim.hpp"
+
+namespace reactorsim {
+
+/***** TraceSink *****/
+
+void TraceSink::recordTick(Reactor& reactor) {
+	int numCells = reactor.width * reactor.height;
+	cellHeatScratch.resize(numCells);
+	for(int i = 0; i < numCells; ++i) {
+		ReactorComponent* comp = reactor.components[i].get();
+		cellHeatScratch[i] = comp ? comp->getCurrentHeat() : 0;
+	}
+	writeFrame(reactor.pendingSimState.curTick, reactor.pendingSimState.reactorHeat, reactor.pendingSimState.euGenerated, &cellHeatScratch[0], numCells);
+}
+
+void TraceSink::recordEvent(Reactor& reactor, int cell, TraceEventKind kind) {
+	TraceEvent event;
+	// Events happen while the tick is being simulated, before curTick is incremented
+	event.tick = reactor.pendingSimState.curTick + 1;
+	event.cell = cell;
+	event.phase = phase;
+	event.kind = kind;
+	writeEvent(event);
+}
+
+
+/***** RingTraceSink *****/
+
+RingTraceSink::RingTraceSink(int numCells, int capacity, int interval) :
+	TraceSink(interval),
+	numCells(numCells),
+	capacity(capacity < 1 ? 1 : capacity),
+	numFrames(0),
+	head(0),
+	totalFrames(0),
+	numEvents(0),
+	eventHead(0),
+	totalEvents(0)
+{
+	ticks.resize(this->capacity);
+	phases.resize(this->capacity);
+	reactorHeat.resize(this->capacity);
+	euGenerated.resize(this->capacity);
+	cellHeat.resize(this->capacity * numCells);
+	events.resize(this->capacity);
+}
+
+void RingTraceSink::writeFrame(int tick, int heat, int eu, const int* heats, int n) {
+	int s;
+	if(numFrames < capacity) {
+		s = slot(numFrames);
+		numFrames++;
+	} else {
+		s = head;
+		head = (head + 1) % capacity;
+	}
+	totalFrames++;
+	ticks[s] = tick;
+	phases[s] = (unsigned char)phase;
+	reactorHeat[s] = heat;
+	euGenerated[s] = eu;
+	int* dest = &cellHeat[s * numCells];
+	for(int i = 0; i < n && i < numCells; ++i) dest[i] = heats[i];
+}
+
+void RingTraceSink::writeEvent(const TraceEvent& event) {
+	int s;
+	if(numEvents < capacity) {
+		s = (eventHead + numEvents) % capacity;
+		numEvents++;
+	} else {
+		s = eventHead;
+		eventHead = (eventHead + 1) % capacity;
+	}
+	totalEvents++;
+	events[s] = event;
+}
+
+
+/***** FileTraceSink *****/
+
+FileTraceSink::FileTraceSink(const std::string& filename, int width, int height, int interval) : TraceSink(interval) {
+	file = fopen(filename.c_str(), "wb");
+	if(file) {
+		int32_t header[5] = { 0x52545352, 1, width, height, this->interval };	// "RSTR"
+		fwrite(header, sizeof(header), 1, file);
+	}
+}
+
+FileTraceSink::~FileTraceSink() {
+	if(file) fclose(file);
+}
+
+void FileTraceSink::writeFrame(int tick, int heat, int eu, const int* heats, int n) {
+	if(!file) return;
+	int32_t rec[5] = { 0, tick, (int32_t)phase, heat, eu };
+	fwrite(rec, sizeof(rec), 1, file);
+	fwrite(heats, sizeof(int32_t), n, file);
+}
+
+void FileTraceSink::writeEvent(const TraceEvent& event) {
+	if(!file) return;
+	int32_t rec[5] = { 1, event.tick, (int32_t)event.phase, event.cell, (int32_t)event.kind };
+	fwrite(rec, sizeof(rec), 1, file);
+}
+
+}
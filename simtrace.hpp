@@ -0,0 +1,116 @@
+#ifndef SIMTRACE_HPP
+#define SIMTRACE_HPP
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+namespace reactorsim {
+
+// Tracing is a compile-time policy.  Unless the addon is built with REACTORSIM_TRACE defined,
+// traceCompiledIn is false and every trace hook in the simulator is removed by the compiler.
+#ifdef REACTORSIM_TRACE
+static const bool traceCompiledIn = true;
+#else
+static const bool traceCompiledIn = false;
+#endif
+
+class Reactor;
+
+// Which reactor in runSimulation() produced a trace record
+enum TracePhase {
+	TRACE_FIRST_RUN,
+	TRACE_COOLDOWN,
+	TRACE_RUN_UNTIL_FINISH,
+	TRACE_RERUN
+};
+
+enum TraceEventKind {
+	TRACE_EVENT_COMPONENT_DESTROYED,
+	TRACE_EVENT_MELTDOWN
+};
+
+struct TraceEvent {
+	int tick;
+	int cell;		// index into the row-major grid, or -1 for reactor-wide events
+	TracePhase phase;
+	TraceEventKind kind;
+};
+
+class TraceSink {
+public:
+	int interval;		// only every interval'th tick is recorded
+	TracePhase phase;
+
+	TraceSink(int interval) : interval(interval < 1 ? 1 : interval), phase(TRACE_FIRST_RUN) {}
+	virtual ~TraceSink() {}
+
+	bool wantsTick(int tick) { return tick % interval == 0; }
+
+	// Called after each simulated tick, with the tick's pending (uncommitted) state
+	void recordTick(Reactor& reactor);
+	void recordEvent(Reactor& reactor, int cell, TraceEventKind kind);
+
+protected:
+	virtual void writeFrame(int tick, int reactorHeat, int euGenerated, const int* cellHeat, int numCells) = 0;	// euGenerated is cumulative
+	virtual void writeEvent(const TraceEvent& event) = 0;
+
+private:
+	std::vector<int> cellHeatScratch;
+};
+
+// Keeps the most recent `capacity` frames in preallocated storage; older frames are overwritten
+class RingTraceSink : public TraceSink {
+public:
+	RingTraceSink(int numCells, int capacity, int interval);
+
+	int numCells;
+	int capacity;
+	int numFrames;	// number of valid frames, <= capacity
+	int head;		// index of the oldest frame
+	long totalFrames;	// frames ever written, including overwritten ones
+
+	std::vector<int> ticks;
+	std::vector<unsigned char> phases;
+	std::vector<int> reactorHeat;
+	std::vector<int> euGenerated;
+	std::vector<int> cellHeat;	// capacity * numCells
+
+	// Events, in a ring of their own with the same capacity
+	int numEvents;
+	int eventHead;
+	long totalEvents;
+	std::vector<TraceEvent> events;
+
+	// Frame index i in chronological order (0 = oldest) to storage slot
+	int slot(int i) const { return (head + i) % capacity; }
+	const TraceEvent& event(int i) const { return events[(eventHead + i) % capacity]; }
+
+protected:
+	void writeFrame(int tick, int reactorHeat, int euGenerated, const int* cellHeat, int numCells);
+	void writeEvent(const TraceEvent& event);
+};
+
+// Streams records to a binary file.  Layout (little endian int32 words):
+//   header: 'RSTR', version, width, height, interval
+//   frame:  0, tick, phase, reactorHeat, euGenerated, cellHeat[width*height]
+//   event:  1, tick, phase, cell, kind
+class FileTraceSink : public TraceSink {
+public:
+	FileTraceSink(const std::string& filename, int width, int height, int interval);
+	~FileTraceSink();
+
+	bool good() { return file != 0; }
+
+protected:
+	void writeFrame(int tick, int reactorHeat, int euGenerated, const int* cellHeat, int numCells);
+	void writeEvent(const TraceEvent& event);
+
+private:
+	FILE* file;
+};
+
+}
+
+#endif
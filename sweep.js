@@ -0,0 +1,259 @@
+var fs = require('fs');
+var events = require('events');
+var util = require('util');
+
+// A layout space of every assignment of the given codes to the cells of a reactor, with sizes and
+// indexes as BigInts.  The first free cell varies fastest.  contains(layout) tells whether a layout
+// is in the space.
+//
+// Options:
+// - extraChambers: Reactor width minus 3 (default 0)
+// - codes: Component codes each free cell can take
+// - fixed: Codes of cells that do not vary, by cell index
+function productSpace(options) {
+	var width = 3 + (options.extraChambers || 0);
+	var numCells = width * 6;
+	var codes = options.codes;
+	var fixed = options.fixed || {};
+	var free = [];
+	for(var i = 0; i < numCells; i++) {
+		if(!(i in fixed)) free.push(i);
+	}
+	var radix = BigInt(codes.length);
+	return {
+		id: 'product:' + width + ':' + codes.join(',') + ':' + JSON.stringify(fixed),
+		size: radix ** BigInt(free.length),
+		layoutAt: function(index) {
+			var layout = new Array(numCells);
+			for(var cell in fixed) layout[cell] = fixed[cell];
+			for(var j = 0; j < free.length; j++) {
+				layout[free[j]] = codes[Number(index % radix)];
+				index /= radix;
+			}
+			return layout;
+		},
+		contains: function(layout) {
+			if(layout.length !== numCells) return false;
+			for(var i = 0; i < numCells; i++) {
+				if(i in fixed ? layout[i] !== fixed[i] : codes.indexOf(layout[i]) < 0) return false;
+			}
+			return true;
+		}
+	};
+}
+
+// Simulates every layout of a space, chunk by chunk, keeping the best scoring ones.  Chunk c belongs
+// to shard c % shards, so processes given different shard indexes split the space between them
+// without coordinating.  Progress is saved to the checkpoint file, and a sweep created with the
+// same space and sharding resumes from it.
+//
+// Options:
+// - space: { id, size, layoutAt(index) }, such as a productSpace().  id identifies it in checkpoints.
+// - skipEquivalent: Of the layouts of the space that are proven to give the same results (see
+//   canonicalizeLayout), simulate only the first in canonical order.  Needs space.contains(layout).
+// - chunkSize: Layouts per chunk, simulated as one batch (default 1000)
+// - shard, shards: Which of how many shards to process (default 0 of 1)
+// - checkpoint: File to save progress to and resume from
+// - checkpointInterval: Minimum milliseconds between checkpoints (default 30000); one is also
+//   written when the sweep finishes or is stopped
+// - score: function(results, layout, index) returning a number, or null to reject the layout
+//   (default: overallEUPerTick of complete results)
+// - keep: Number of best layouts kept (default 10)
+// - simulation: Options passed to runSimulationBatch
+//
+// Emits 'chunk' after every chunk and 'checkpoint' after every checkpoint, with the state.
+function Sweep(reactorsim, options) {
+	events.EventEmitter.call(this);
+	this._reactorsim = reactorsim;
+	this._space = options.space;
+	this._chunkSize = options.chunkSize || 1000;
+	this._shard = options.shard || 0;
+	this._shards = options.shards || 1;
+	this._checkpointFile = options.checkpoint;
+	this._checkpointInterval = options.checkpointInterval === undefined ? 30000 : options.checkpointInterval;
+	this._score = options.score || defaultScore;
+	this._keep = options.keep || 10;
+	this._simOptions = options.simulation || {};
+	this._skipEquivalent = !!options.skipEquivalent;
+	this._numChunks = (BigInt(this._space.size) + BigInt(this._chunkSize) - 1n) / BigInt(this._chunkSize);
+	this._handle = null;
+	this._stopping = false;
+	this._lastCheckpoint = Date.now();
+	this.state = {
+		nextChunk: BigInt(this._shard),
+		chunks: 0,
+		simulated: 0,
+		accepted: 0,
+		incomplete: 0,
+		skipped: 0,		// equivalent to a layout of the space that is simulated instead
+		best: [],		// { index, score, layout, results }, best first
+		done: false
+	};
+	if(this._checkpointFile && fs.existsSync(this._checkpointFile)) {
+		this._restore(JSON.parse(fs.readFileSync(this._checkpointFile, 'utf8')));
+	}
+}
+util.inherits(Sweep, events.EventEmitter);
+
+function defaultScore(results) {
+	return results.incomplete ? null : results.overallEUPerTick;
+}
+
+// Runs the sweep to the end, or until stop() is called, and calls back with the state
+Sweep.prototype.run = function(callback) {
+	var self = this;
+	function next() {
+		if(self._stopping || self.state.nextChunk >= self._numChunks) {
+			if(!self._stopping) self.state.done = true;
+			try {
+				self._saveCheckpoint();
+			} catch (e) {
+				return callback(e);
+			}
+			return callback(null, self.state);
+		}
+		self._runChunk(self.state.nextChunk, function(error) {
+			if(error) return callback(error);
+			if(self._checkpointFile && Date.now() - self._lastCheckpoint >= self._checkpointInterval) {
+				try {
+					self._saveCheckpoint();
+				} catch (e) {
+					return callback(e);
+				}
+			}
+			next();
+		});
+	}
+	next();
+};
+
+// Cancels the chunk being simulated, which is redone on resume, and finishes the run
+Sweep.prototype.stop = function() {
+	this._stopping = true;
+	if(this._handle) this._handle.cancel();
+};
+
+Sweep.prototype._runChunk = function(chunk, callback) {
+	var self = this;
+	var start = chunk * BigInt(this._chunkSize);
+	var end = start + BigInt(this._chunkSize);
+	var size = BigInt(this._space.size);
+	if(end > size) end = size;
+	var layouts = [];
+	var indexes = [];
+	var skipped = 0;
+	for(var index = start; index < end; index++) {
+		var layout = this._space.layoutAt(index);
+		if(this._skipEquivalent && this._isSkippable(layout)) {
+			skipped++;
+			continue;
+		}
+		layouts.push(layout);
+		indexes.push(index);
+	}
+	this._handle = this._reactorsim.runSimulationBatch(layouts, this._simOptions, function(error, results) {
+		self._handle = null;
+		if(error) return callback(error);
+		// A stopped chunk is left for the resumed run, so that every chunk is counted exactly once
+		if(self._stopping) return callback();
+		var state = self.state;
+		state.skipped += skipped;
+		for(var i = 0; i < results.length; i++) {
+			state.simulated++;
+			if(results[i].incomplete) state.incomplete++;
+			var score = self._score(results[i], layouts[i], indexes[i]);
+			if(score === null || score === undefined) continue;
+			state.accepted++;
+			self._offer({ index: indexes[i], score: score, layout: layouts[i], results: results[i] });
+		}
+		state.chunks++;
+		state.nextChunk = chunk + BigInt(self._shards);
+		self.emit('chunk', state);
+		callback();
+	});
+};
+
+// Whether the layout is proven equivalent to another layout of the space that is simulated instead.
+// Every layout of an equivalence class lists the same equivalents in the same order, so exactly
+// one of those in the space is kept.
+Sweep.prototype._isSkippable = function(layout) {
+	var equivalents = this._reactorsim.canonicalizeLayout(layout).equivalents;
+	if(equivalents.length < 2) return false;
+	for(var e = 0; e < equivalents.length; e++) {
+		if(this._space.contains(equivalents[e])) return !sameLayout(equivalents[e], layout);
+	}
+	return false;
+};
+
+function sameLayout(a, b) {
+	for(var i = 0; i < a.length; i++) {
+		if(a[i] !== b[i]) return false;
+	}
+	return true;
+}
+
+// Keeps the entry if it is among the best, with ties going to the lower index so that the outcome
+// does not depend on chunk order
+Sweep.prototype._offer = function(entry) {
+	var best = this.state.best;
+	var pos = best.length;
+	while(pos > 0 && (best[pos - 1].score < entry.score || (best[pos - 1].score === entry.score && best[pos - 1].index > entry.index))) {
+		pos--;
+	}
+	if(pos >= this._keep) return;
+	best.splice(pos, 0, entry);
+	if(best.length > this._keep) best.pop();
+};
+
+// Written to a temporary file and renamed over the checkpoint, so a crash leaves either the old or
+// the new one
+Sweep.prototype._saveCheckpoint = function() {
+	if(!this._checkpointFile) return;
+	var state = this.state;
+	var checkpoint = {
+		version: 1,
+		space: this._space.id,
+		size: String(this._space.size),
+		chunkSize: this._chunkSize,
+		shard: this._shard,
+		shards: this._shards,
+		skipEquivalent: this._skipEquivalent,
+		nextChunk: String(state.nextChunk),
+		chunks: state.chunks,
+		simulated: state.simulated,
+		accepted: state.accepted,
+		incomplete: state.incomplete,
+		skipped: state.skipped,
+		done: state.done,
+		best: state.best.map(function(entry) {
+			return { index: String(entry.index), score: entry.score, layout: entry.layout, results: entry.results };
+		})
+	};
+	var tmpFile = this._checkpointFile + '.tmp';
+	fs.writeFileSync(tmpFile, JSON.stringify(checkpoint));
+	fs.renameSync(tmpFile, this._checkpointFile);
+	this._lastCheckpoint = Date.now();
+	this.emit('checkpoint', state);
+};
+
+Sweep.prototype._restore = function(checkpoint) {
+	if(checkpoint.version !== 1 || checkpoint.space !== this._space.id || checkpoint.size !== String(this._space.size) ||
+		checkpoint.chunkSize !== this._chunkSize || checkpoint.shard !== this._shard || checkpoint.shards !== this._shards ||
+		!!checkpoint.skipEquivalent !== this._skipEquivalent) {
+		throw new Error('Checkpoint ' + this._checkpointFile + ' belongs to a different sweep');
+	}
+	var state = this.state;
+	state.nextChunk = BigInt(checkpoint.nextChunk);
+	state.chunks = checkpoint.chunks;
+	state.simulated = checkpoint.simulated;
+	state.accepted = checkpoint.accepted;
+	state.incomplete = checkpoint.incomplete;
+	state.skipped = checkpoint.skipped || 0;
+	state.done = checkpoint.done;
+	state.best = checkpoint.best.map(function(entry) {
+		return { index: BigInt(entry.index), score: entry.score, layout: entry.layout, results: entry.results };
+	});
+};
+
+exports.productSpace = productSpace;
+exports.Sweep = Sweep;
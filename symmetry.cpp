@@ -0,0 +1,238 @@
+#include "symmetry.hpp"
+#include <algorithm>
+#include <cstdint>
+
+namespace reactorsim {
+
+namespace {
+
+struct Position {
+	int x, y;
+};
+
+Position transformPosition(Position p, int width, int height, LayoutTransform transform) {
+	switch(transform) {
+		case TRANSFORM_MIRROR_X: return { width - 1 - p.x, p.y };
+		case TRANSFORM_MIRROR_Y: return { p.x, height - 1 - p.y };
+		case TRANSFORM_ROTATE_180: return { width - 1 - p.x, height - 1 - p.y };
+		case TRANSFORM_TRANSPOSE: return { p.y, p.x };
+		case TRANSFORM_ANTI_TRANSPOSE: return { height - 1 - p.y, width - 1 - p.x };
+		case TRANSFORM_ROTATE_90: return { height - 1 - p.y, p.x };
+		case TRANSFORM_ROTATE_270: return { p.y, width - 1 - p.x };
+		default: return p;
+	}
+}
+
+int transformedWidth(int width, int height, LayoutTransform transform) {
+	return transform > TRANSFORM_ROTATE_180 ? height : width;
+}
+
+bool isFuel(ComponentType type) {
+	return type == URANIUM_CELL || type == DUAL_URANIUM_CELL || type == QUAD_URANIUM_CELL;
+}
+
+bool isReflector(ComponentType type) {
+	return type == NEUTRON_REFLECTOR || type == THICK_NEUTRON_REFLECTOR;
+}
+
+bool isExchanger(ComponentType type) {
+	return type == HEAT_EXCHANGER || type == ADVANCED_HEAT_EXCHANGER || type == CORE_HEAT_EXCHANGER || type == COMPONENT_HEAT_EXCHANGER;
+}
+
+bool isHeatVent(ComponentType type) {
+	return type == HEAT_VENT || type == REACTOR_HEAT_VENT || type == ADVANCED_HEAT_VENT || type == OVERCLOCKED_HEAT_VENT;
+}
+
+// Components that canStoreHeat(), at least until they fill up or are destroyed
+bool storesHeat(ComponentType type) {
+	return isHeatVent(type) || isExchanger(type) || type == COOLANT_CELL_10 || type == COOLANT_CELL_30 || type == COOLANT_CELL_60 ||
+		type == CONDENSATOR_RSH || type == CONDENSATOR_LZH;
+}
+
+// What a component's tick depends on and changes.  Fuel cells never run past their fuel, so whether
+// one accepts pulses does not change during a run and is not counted.
+struct Footprint {
+	int cell;
+	uint64_t reads = 0;		// bits of the cells whose component (or its presence) the tick depends on
+	uint64_t writes = 0;	// bits of the cells whose component the tick changes, and may destroy
+	bool addsHullHeat = false;	// only adds to the hull heat, which commutes with other additions
+	bool usesHullHeat = false;	// reads and sets the hull heat
+	bool readsMaxHeat = false;	// the hull's, which reactor platings add to as they tick
+	bool addsMaxHeat = false;
+	std::vector<int> visits;	// neighbours acted on in an order that matters, in that order
+};
+
+// Cells of the existing neighbours in the order components visit them: left, right, above, below
+int getNeighbours(const std::vector<ComponentType>& types, int width, int height, int cell, int* neighbours) {
+	int x = cell % width;
+	int y = cell / width;
+	int candidates[4] = { x > 0 ? cell - 1 : -1, x < width - 1 ? cell + 1 : -1, y > 0 ? cell - width : -1, y < height - 1 ? cell + width : -1 };
+	int count = 0;
+	for(int c : candidates) {
+		if(c >= 0 && types[c] != COMPONENT_NONE) neighbours[count++] = c;
+	}
+	return count;
+}
+
+std::vector<Footprint> getFootprints(const std::vector<ComponentType>& types, int width, int height) {
+	std::vector<Footprint> footprints;
+	for(int cell = 0; cell < (int)types.size(); ++cell) {
+		ComponentType type = types[cell];
+		Footprint footprint;
+		footprint.cell = cell;
+		int neighbours[4];
+		int numNeighbours = getNeighbours(types, width, height, cell, neighbours);
+		if(isFuel(type)) {
+			// Pulses neighbours (wearing reflectors) and spreads its heat over the ones that store heat,
+			// with the remainder of the division and any overflow going to the later ones and the hull
+			for(int i = 0; i < numNeighbours; ++i) {
+				int n = neighbours[i];
+				footprint.reads |= (uint64_t)1 << n;
+				if(isReflector(types[n])) footprint.writes |= (uint64_t)1 << n;
+				if(storesHeat(types[n])) {
+					footprint.writes |= (uint64_t)1 << n;
+					footprint.visits.push_back(n);
+				}
+			}
+			footprint.addsHullHeat = true;
+			footprint.readsMaxHeat = true;
+		} else if(isHeatVent(type)) {
+			footprint.writes |= (uint64_t)1 << cell;
+			if(type == REACTOR_HEAT_VENT || type == OVERCLOCKED_HEAT_VENT) {
+				footprint.usesHullHeat = true;
+				footprint.readsMaxHeat = true;
+			}
+		} else if(type == COMPONENT_HEAT_VENT) {
+			// Cools each neighbour independently of the others
+			for(int i = 0; i < numNeighbours; ++i) {
+				footprint.reads |= (uint64_t)1 << neighbours[i];
+				if(storesHeat(types[neighbours[i]])) footprint.writes |= (uint64_t)1 << neighbours[i];
+			}
+		} else if(isExchanger(type)) {
+			// Sums the heat ratios of its neighbours in visiting order, in floating point
+			footprint.writes |= (uint64_t)1 << cell;
+			if(type != CORE_HEAT_EXCHANGER) {
+				for(int i = 0; i < numNeighbours; ++i) {
+					int n = neighbours[i];
+					footprint.reads |= (uint64_t)1 << n;
+					if(storesHeat(types[n])) {
+						footprint.writes |= (uint64_t)1 << n;
+						footprint.visits.push_back(n);
+					}
+				}
+			}
+			if(type != COMPONENT_HEAT_EXCHANGER) {
+				footprint.usesHullHeat = true;
+				footprint.readsMaxHeat = true;
+			}
+		} else if(type == REACTOR_PLATING || type == CONTAINMENT_REACTOR_PLATING || type == HEAT_CAPACITY_REACTOR_PLATING) {
+			footprint.addsMaxHeat = true;
+		} else {
+			continue;	// does nothing when it ticks
+		}
+		footprints.push_back(footprint);
+	}
+	return footprints;
+}
+
+// Whether running the two ticks in either order can give different results
+bool conflicts(const Footprint& a, const Footprint& b) {
+	if((a.writes & (b.writes | b.reads)) || (b.writes & a.reads)) return true;
+	if(a.usesHullHeat && (b.usesHullHeat || b.addsHullHeat)) return true;
+	if(b.usesHullHeat && a.addsHullHeat) return true;
+	return (a.addsMaxHeat && b.readsMaxHeat) || (b.addsMaxHeat && a.readsMaxHeat);
+}
+
+// Pairs of cells, first before second in row-major order, whose ticks must keep their order
+std::vector<std::pair<int, int>> getOrderedPairs(const std::vector<Footprint>& footprints) {
+	std::vector<std::pair<int, int>> pairs;
+	for(size_t i = 0; i < footprints.size(); ++i) {
+		for(size_t j = i + 1; j < footprints.size(); ++j) {
+			if(conflicts(footprints[i], footprints[j])) pairs.push_back(std::make_pair(footprints[i].cell, footprints[j].cell));
+		}
+	}
+	return pairs;
+}
+
+int transformCell(int cell, int width, int height, LayoutTransform transform) {
+	Position p = transformPosition({ cell % width, cell / width }, width, height, transform);
+	return p.y * transformedWidth(width, height, transform) + p.x;
+}
+
+// Index of the direction in visiting order (left, right, above, below) from one cell to a neighbour
+// after the transform
+int transformedDirection(int from, int to, int width, int height, LayoutTransform transform) {
+	Position a = transformPosition({ from % width, from / width }, width, height, transform);
+	Position b = transformPosition({ to % width, to / width }, width, height, transform);
+	if(b.x < a.x) return 0;
+	if(b.x > a.x) return 1;
+	if(b.y < a.y) return 2;
+	return 3;
+}
+
+bool preservesOrder(const std::vector<Footprint>& footprints, const std::vector<std::pair<int, int>>& pairs, int width, int height, LayoutTransform transform) {
+	for(const std::pair<int, int>& pair : pairs) {
+		if(transformCell(pair.first, width, height, transform) > transformCell(pair.second, width, height, transform)) return false;
+	}
+	for(const Footprint& footprint : footprints) {
+		for(size_t i = 1; i < footprint.visits.size(); ++i) {
+			if(transformedDirection(footprint.cell, footprint.visits[i - 1], width, height, transform) >
+				transformedDirection(footprint.cell, footprint.visits[i], width, height, transform)) return false;
+		}
+	}
+	return true;
+}
+
+}
+
+bool isTransformApplicable(LayoutTransform transform, int width, int height) {
+	return transform <= TRANSFORM_ROTATE_180 || width == height;
+}
+
+std::vector<ComponentType> transformLayout(const std::vector<ComponentType>& types, int width, int height, LayoutTransform transform) {
+	std::vector<ComponentType> transformed(types.size(), COMPONENT_NONE);
+	for(int cell = 0; cell < (int)types.size(); ++cell) {
+		transformed[transformCell(cell, width, height, transform)] = types[cell];
+	}
+	return transformed;
+}
+
+bool isEquivalentUnder(const std::vector<ComponentType>& types, int width, int height, LayoutTransform transform) {
+	if(!isTransformApplicable(transform, width, height)) return false;
+	if(transform == TRANSFORM_IDENTITY) return true;
+	std::vector<Footprint> footprints = getFootprints(types, width, height);
+	return preservesOrder(footprints, getOrderedPairs(footprints), width, height, transform);
+}
+
+std::vector<std::vector<ComponentType>> getEquivalentLayouts(const std::vector<ComponentType>& types, int width, int height) {
+	// Every layout reached is an image of the original under the grid's symmetries, so there are at
+	// most TRANSFORM_COUNT of them
+	std::vector<std::vector<ComponentType>> reached(1, types);
+	for(size_t i = 0; i < reached.size(); ++i) {
+		std::vector<Footprint> footprints = getFootprints(reached[i], width, height);
+		std::vector<std::pair<int, int>> pairs = getOrderedPairs(footprints);
+		for(int t = TRANSFORM_IDENTITY + 1; t < TRANSFORM_COUNT; ++t) {
+			LayoutTransform candidate = (LayoutTransform)t;
+			if(!isTransformApplicable(candidate, width, height) || !preservesOrder(footprints, pairs, width, height, candidate)) continue;
+			std::vector<ComponentType> image = transformLayout(reached[i], width, height, candidate);
+			if(std::find(reached.begin(), reached.end(), image) == reached.end()) reached.push_back(image);
+		}
+	}
+	std::sort(reached.begin(), reached.end());
+	return reached;
+}
+
+std::vector<ComponentType> canonicalizeLayout(const std::vector<ComponentType>& types, int width, int height, LayoutTransform* transform) {
+	std::vector<ComponentType> canonical = getEquivalentLayouts(types, width, height).front();
+	if(transform) {
+		for(int t = TRANSFORM_IDENTITY; t < TRANSFORM_COUNT; ++t) {
+			if(isTransformApplicable((LayoutTransform)t, width, height) && transformLayout(types, width, height, (LayoutTransform)t) == canonical) {
+				*transform = (LayoutTransform)t;
+				break;
+			}
+		}
+	}
+	return canonical;
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef SYMMETRY_HPP
+#define SYMMETRY_HPP
+
+#include "reactorsim.hpp"
+
+namespace reactorsim {
+
+// Symmetries of the grid.  Those after TRANSFORM_ROTATE_180 swap rows and columns, so they only
+// apply to square (6x6) reactors.
+enum LayoutTransform {
+	TRANSFORM_IDENTITY,
+	TRANSFORM_MIRROR_X,			// left to right
+	TRANSFORM_MIRROR_Y,			// top to bottom
+	TRANSFORM_ROTATE_180,
+	TRANSFORM_TRANSPOSE,		// about the main diagonal
+	TRANSFORM_ANTI_TRANSPOSE,	// about the other diagonal
+	TRANSFORM_ROTATE_90,		// clockwise
+	TRANSFORM_ROTATE_270,
+	TRANSFORM_COUNT
+};
+
+bool isTransformApplicable(LayoutTransform transform, int width, int height);
+
+// The layout with the component at (x, y) moved to the transformed position
+std::vector<ComponentType> transformLayout(const std::vector<ComponentType>& types, int width, int height, LayoutTransform transform);
+
+// Whether simulating the transformed layout is guaranteed to give the same SimulationResults.
+// Components tick in row-major order and some of them act on state that others act on too, so the
+// simulation is not symmetric in general.  The transform is accepted only if it keeps the relative
+// order of every two components whose ticks do not commute, and the order in which each fuel cell
+// and heat exchanger visits its heat-storing neighbours.  False means not proven, not different.
+bool isEquivalentUnder(const std::vector<ComponentType>& types, int width, int height, LayoutTransform transform);
+
+// The layouts the layout is proven equivalent to, directly or through a chain of proven transforms,
+// itself included, smallest first (comparing component types cell by cell).  Every layout of such
+// a class gets the same list.
+std::vector<std::vector<ComponentType>> getEquivalentLayouts(const std::vector<ComponentType>& types, int width, int height);
+
+// The first of getEquivalentLayouts(), so that every layout of a class has the same canonical form.
+// Sets transform to one that maps the layout onto it.
+std::vector<ComponentType> canonicalizeLayout(const std::vector<ComponentType>& types, int width, int height, LayoutTransform* transform = 0);
+
+}
+
+#endif
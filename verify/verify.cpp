@@ -0,0 +1,484 @@
+// Differential verification of the simulation engines against the frozen reference implementation.
+//
+// Usage: reactorsim-verify [--count n] [--seed s] [--ticks] [--symmetry] [--engine name] [--brute-force-cycles n]
+//                          [--corpus dir]
+//
+// Checks the layouts of a benchmark corpus (see bench/bench.cpp) if one is given, then generates
+// random and adversarial layouts.  It runs each through the reference and every engine in
+// the engines table, and compares all SimulationResults fields.  Engines that simulate exact cycles
+// are compared against a loop that reruns the reactor cycle by cycle for the multi-cycle fields, as
+// far as the engine got by simulating or skipping cycles; layouts where that is more than
+// --brute-force-cycles (default 10000) are counted as unverified rather than verified.
+// With --ticks, the first fuel cycle is also stepped in lockstep and the reactor and per-cell heat
+// compared after every tick.  With --symmetry, every mirrored or rotated layout that
+// isEquivalentUnder() claims is equivalent is run through the engines too and must give the same
+// results.  On a mismatch, the layout is shrunk to a minimal counterexample, printed, and the exit
+// status is 1.
+
+#include "reference.hpp"
+#include "../reactorsim.hpp"
+#include "../gridio.hpp"
+#include "../symmetry.hpp"
+#include "../simstats.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace reactorsim;
+
+struct Layout {
+	int width;
+	std::vector<ComponentType> types;
+};
+
+#define SIM_RESULT_FIELDS(F) \
+	F(efficiency) F(totalEUPerCycle) F(euPerTick) F(overallEUPerTick) F(usesSingleUseCoolant) \
+	F(timedOut) F(cooldownTicks) F(cycleTicks) F(mark) F(numIterationsBeforeFailure) \
+	F(ticksUntilMeltdown) F(ticksUntilComponentFailure) F(totalCost)
+
+
+/***** Engines *****/
+
+struct Engine {
+	const char* name;
+	SimulationResults (*run)(const Layout& layout);
+	// 0 to compare against the reference, otherwise the maxCycles the engine simulates exact cycles
+	// with, to compare against the brute-force cycle loop instead
+	int maxCycles;
+};
+
+static SimulationResults runReference(const Layout& layout) {
+	reference::Reactor reactor(layout.width - 3);
+	reactor.setComponentTypes(layout.types);
+	return reference::runSimulation(reactor);
+}
+
+static SimulationResults runScalar(const Layout& layout) {
+	Reactor reactor(layout.width - 3);
+	reactor.setComponentTypes(layout.types);
+	return runSimulation(reactor);
+}
+
+static SimulationResults runExactCycles(const Layout& layout, int maxCycles) {
+	Reactor reactor(layout.width - 3);
+	reactor.setComponentTypes(layout.types);
+	SimulationOptions options;
+	options.exactCycles = true;
+	options.maxCycles = maxCycles;
+	return runSimulation(reactor, options);
+}
+
+static SimulationResults runExactCycles(const Layout& layout) {
+	return runExactCycles(layout, SimulationOptions().maxCycles);
+}
+
+// Gives up after the second cycle, where skipping ahead cannot have started yet
+static SimulationResults runExactCyclesMax2(const Layout& layout) {
+	return runExactCycles(layout, 2);
+}
+
+static const Engine engines[] = {
+	{ "scalar", runScalar, 0 },
+	{ "exact-cycles", runExactCycles, 1000 },
+	{ "exact-cycles-max2", runExactCyclesMax2, 2 }
+};
+
+
+/***** Brute-force cycles *****/
+
+namespace reactorsim { namespace reference {
+	int getCyclesUntilFailure(int firstRunHeat, int secondRunHeat, int maxHeat);	// not in reference.hpp
+} }
+
+// Most cycles the brute-force loop simulates before a layout is reported as unverified
+// (--brute-force-cycles); more than every engine's maxCycles
+static int bruteForceCycles = 10000;
+static const int cyclesUnsettled = -2;
+
+// Reruns a reactor that has completed its first cycle cycle by cycle, without skipping any, until
+// a cycle fails, the state repeats, or horizon cycles (including the first) have completed.
+// Returns the number of cycles completed before the failing one, -1 if it repeats, or
+// cyclesUnsettled.  states gets the state after each completed cycle.
+static int runCyclesBruteForce(Reactor reactor, int horizon, std::vector<ReactorSnapshot>& states) {
+	states.assign(1, reactor.captureSnapshot());
+	std::unordered_multimap<size_t, size_t> seen;	// state hash to index
+	seen.insert(std::make_pair(states[0].hash(), 0));
+	for(int completed = 1; completed < horizon; ++completed) {
+		reactor.resetUsage();
+		if(reactor.runUntil(true, true, false, true) != STOPPED_ON_FUEL_USED) return completed;
+		reactor.commit();
+		states.push_back(reactor.captureSnapshot());
+		size_t hash = states.back().hash();
+		auto range = seen.equal_range(hash);
+		for(auto itr = range.first; itr != range.second; ++itr) {
+			if(states[itr->second] == states.back()) return -1;
+		}
+		seen.insert(std::make_pair(hash, states.size() - 1));
+	}
+	return cyclesUnsettled;
+}
+
+// The results an exact-cycles engine must give: the reference's, with mark I and II reactors that
+// are rerun after their first cycle classified by the brute-force loop instead of extrapolated.
+// engineCycles is the number of cycles the engine got through, simulated or skipped, including
+// the first.  The loop runs that many: the engine must have found the same failure or repeat, or
+// if there was none, given up there and extrapolated from the last two cycles.  Sets unverified,
+// and returns actual, if that is more than bruteForceCycles.
+static SimulationResults getExactCyclesResults(const Layout& layout, long engineCycles, const SimulationResults& actual, bool& unverified) {
+	SimulationResults expected = runReference(layout);
+	Reactor reactor(layout.width - 3);
+	reactor.setComponentTypes(layout.types);
+	reactor.initializeSimulation();
+	if(reactor.runUntil(true, true, false, true) != STOPPED_ON_FUEL_USED) return expected;
+	reactor.commit();
+	if(reactor.curSimState.totalHeat <= 0) return expected;	// cold after every cycle
+	if(engineCycles < 2 || engineCycles > bruteForceCycles) {
+		unverified = true;
+		return actual;
+	}
+
+	// The cooldown gives the cycle length of mark II reactors
+	Reactor cooldownReactor(reactor);
+	cooldownReactor.removeFuel();
+	cooldownReactor.ignoreComponentDestroyed = true;
+	int cooldownCycleTicks = -1;
+	int cooldownOverallEUPerTick = 0;
+	if(cooldownReactor.runUntil(false, false, true, false) == STOPPED_ON_COOLED_DOWN) {
+		cooldownCycleTicks = cooldownReactor.curSimState.curTick;
+		cooldownOverallEUPerTick = (float)expected.totalEUPerCycle / (float)cooldownCycleTicks;
+	}
+
+	std::vector<ReactorSnapshot> states;
+	int cycles = runCyclesBruteForce(reactor, engineCycles, states);
+	if(cycles == cyclesUnsettled) {
+		// getCyclesUntilFailure() counts prev, the state after cycle engineCycles - 1, as cycle 1
+		const ReactorSnapshot& prev = states[states.size() - 2];
+		const ReactorSnapshot& last = states.back();
+		int minCycles = reference::getCyclesUntilFailure(prev.reactorHeat, last.reactorHeat, reactor.getMaxHeat());
+		for(size_t i = 0; i < last.cellHeat.size(); ++i) {
+			if(!last.cellPresent[i]) continue;
+			int cuf = reference::getCyclesUntilFailure(prev.cellHeat[i], last.cellHeat[i], reactor.components[i]->getMaxHeat());
+			if(cuf != -1 && (minCycles == -1 || cuf < minCycles)) minCycles = cuf;
+		}
+		cycles = minCycles == -1 ? -1 : engineCycles - 2 + minCycles;
+	}
+	if(cycles == -1) {
+		expected.mark = 1;
+		expected.numIterationsBeforeFailure = SimulationResults().numIterationsBeforeFailure;
+		expected.overallEUPerTick = expected.euPerTick;
+		expected.cycleTicks = Reactor::fuelTicks;
+	} else {
+		expected.mark = 2;
+		expected.numIterationsBeforeFailure = cycles;
+		expected.overallEUPerTick = cooldownOverallEUPerTick;
+		expected.cycleTicks = cooldownCycleTicks;
+	}
+	return expected;
+}
+
+// Runs an engine.  cycles is set to the number of fuel cycles its exact multi-cycle analysis got
+// through, simulated or skipped, including the first, as its stats count them.
+static SimulationResults runEngine(const Engine& engine, const Layout& layout, long& cycles) {
+	StatsSnapshot before = collectStats();
+	SimulationResults results = engine.run(layout);
+	StatsSnapshot after = collectStats();
+	cycles = 1 + (long)(after.values[STAT_CYCLES_SIMULATED] - before.values[STAT_CYCLES_SIMULATED]) +
+		(long)(after.values[STAT_CYCLES_SKIPPED] - before.values[STAT_CYCLES_SKIPPED]);
+	return results;
+}
+
+
+/***** Comparison *****/
+
+// Returns the name of the first differing field, or 0 if the results match
+static const char* compareResults(const SimulationResults& a, const SimulationResults& b) {
+#define COMPARE_FIELD(name) if(a.name != b.name && !(std::isnan((double)a.name) && std::isnan((double)b.name))) return #name;
+	SIM_RESULT_FIELDS(COMPARE_FIELD)
+#undef COMPARE_FIELD
+	return 0;
+}
+
+template<class R>
+static void runLockstepTick(R& reactor) {
+	reactor.runTick();
+	reactor.pendingSimState.curTick++;
+}
+
+// Steps the first fuel cycle of both implementations in lockstep.  Returns a description of the
+// first difference, or an empty string.
+static std::string compareTicks(const Layout& layout) {
+	reference::Reactor ref(layout.width - 3);
+	ref.setComponentTypes(layout.types);
+	ref.initializeSimulation();
+	Reactor cur(layout.width - 3);
+	cur.setComponentTypes(layout.types);
+	cur.initializeSimulation();
+
+	for(int tick = 1; tick <= Reactor::fuelTicks; ++tick) {
+		runLockstepTick(ref);
+		runLockstepTick(cur);
+		const char* field = 0;
+		if(ref.pendingSimState.reactorHeat != cur.pendingSimState.reactorHeat) field = "reactorHeat";
+		else if(ref.pendingSimState.euGenerated != cur.pendingSimState.euGenerated) field = "euGenerated";
+		else if(ref.pendingSimState.totalHeat != cur.pendingSimState.totalHeat) field = "totalHeat";
+		else if(ref.pendingSimState.meltdown != cur.pendingSimState.meltdown) field = "meltdown";
+		else if(ref.pendingSimState.componentFailed != cur.pendingSimState.componentFailed) field = "componentFailed";
+		for(size_t i = 0; !field && i < layout.types.size(); ++i) {
+			reference::ReactorComponent* rc = ref.components[i].get();
+			ReactorComponent* cc = cur.components[i].get();
+			if((rc ? rc->getCurrentHeat() : 0) != (cc ? cc->getCurrentHeat() : 0)) field = "cellHeat";
+			else if((rc && rc->isDestroyed()) != (cc && cc->isDestroyed())) field = "destroyed";
+		}
+		if(field) return std::string(field) + " at tick " + std::to_string(tick);
+		if(ref.pendingSimState.meltdown || ref.pendingSimState.componentFailed) break;
+		ref.commit();
+		cur.commit();
+	}
+	return "";
+}
+
+static const char* transformNames[] = { "identity", "mirrorX", "mirrorY", "rotate180", "transpose", "antiTranspose", "rotate90", "rotate270" };
+
+// Runs the images of the layout under every transform proven to preserve its results.  Returns a
+// description of the first difference, or an empty string.
+static std::string compareSymmetries(const Layout& layout, const char* onlyEngine) {
+	for(int t = TRANSFORM_IDENTITY + 1; t < TRANSFORM_COUNT; ++t) {
+		LayoutTransform transform = (LayoutTransform)t;
+		if(!isEquivalentUnder(layout.types, layout.width, 6, transform)) continue;
+		Layout image = { layout.width, transformLayout(layout.types, layout.width, 6, transform) };
+		for(const Engine& engine : engines) {
+			if(onlyEngine && strcmp(onlyEngine, engine.name)) continue;
+			const char* field = compareResults(engine.run(layout), engine.run(image));
+			if(field) return std::string(transformNames[t]) + " " + engine.name + ": " + field;
+		}
+	}
+	return "";
+}
+
+// Returns a description of the first mismatch for the layout, or an empty string.  Sets
+// *unverified if an exact-cycles engine got through more cycles than the brute-force loop may run.
+static std::string checkLayout(const Layout& layout, const char* onlyEngine, bool ticks, bool symmetry, bool* unverified = 0) {
+	SimulationResults expected = runReference(layout);
+	for(const Engine& engine : engines) {
+		if(onlyEngine && strcmp(onlyEngine, engine.name)) continue;
+		long cycles;
+		SimulationResults actual = runEngine(engine, layout, cycles);
+		bool beyondBruteForce = false;
+		const char* field = compareResults(engine.maxCycles ? getExactCyclesResults(layout, cycles, actual, beyondBruteForce) : expected, actual);
+		if(field) return std::string(engine.name) + ": " + field;
+		if(beyondBruteForce && unverified) *unverified = true;
+	}
+	if(ticks) {
+		std::string diff = compareTicks(layout);
+		if(!diff.empty()) return "ticks: " + diff;
+	}
+	if(symmetry) {
+		std::string diff = compareSymmetries(layout, onlyEngine);
+		if(!diff.empty()) return "symmetry: " + diff;
+	}
+	return "";
+}
+
+
+/***** Layout generation *****/
+
+static ComponentType pick(std::mt19937& rng, const std::vector<ComponentType>& palette) {
+	return palette[rng() % palette.size()];
+}
+
+static Layout randomLayout(std::mt19937& rng, const std::vector<ComponentType>& palette, int density) {
+	Layout layout;
+	layout.width = 3 + rng() % 7;
+	layout.types.resize(layout.width * 6);
+	for(ComponentType& type : layout.types) {
+		type = ((int)(rng() % 100) < density) ? pick(rng, palette) : COMPONENT_NONE;
+	}
+	return layout;
+}
+
+static Layout generateLayout(std::mt19937& rng) {
+	static const std::vector<ComponentType> fuel = { URANIUM_CELL, DUAL_URANIUM_CELL, QUAD_URANIUM_CELL };
+	std::vector<ComponentType> all;
+	for(int t = COMPONENT_NONE + 1; t < COMPONENT_COUNT; ++t) all.push_back((ComponentType)t);
+
+	// Adversarial palettes target the order-dependent and boundary-heavy mechanics
+	static const std::vector<std::vector<ComponentType>> palettes = {
+		// heat exchanger networks
+		{ HEAT_EXCHANGER, ADVANCED_HEAT_EXCHANGER, CORE_HEAT_EXCHANGER, COMPONENT_HEAT_EXCHANGER, HEAT_VENT, COMPONENT_HEAT_VENT, COOLANT_CELL_10 },
+		// hull heat and plating (max heat accumulates during the tick)
+		{ REACTOR_PLATING, CONTAINMENT_REACTOR_PLATING, HEAT_CAPACITY_REACTOR_PLATING, REACTOR_HEAT_VENT, OVERCLOCKED_HEAT_VENT, CORE_HEAT_EXCHANGER },
+		// limited-use components
+		{ CONDENSATOR_RSH, CONDENSATOR_LZH, NEUTRON_REFLECTOR, THICK_NEUTRON_REFLECTOR, COMPONENT_HEAT_VENT },
+		// slow cooldowns
+		{ COOLANT_CELL_10, COOLANT_CELL_30, COOLANT_CELL_60, COMPONENT_HEAT_VENT, HEAT_VENT }
+	};
+
+	int kind = rng() % 8;
+	if(kind < 3) {
+		// Uniformly random, with varying density
+		return randomLayout(rng, all, rng() % 101);
+	} else if(kind < 7) {
+		Layout layout = randomLayout(rng, palettes[kind - 3], 40 + rng() % 61);
+		int numFuel = 1 + rng() % 4;
+		for(int i = 0; i < numFuel; ++i) layout.types[rng() % layout.types.size()] = pick(rng, fuel);
+		return layout;
+	} else {
+		// A single fuel cell somewhere (often an edge or corner) in an otherwise sparse reactor
+		Layout layout = randomLayout(rng, all, rng() % 20);
+		layout.types[rng() % layout.types.size()] = pick(rng, fuel);
+		return layout;
+	}
+}
+
+
+// The grids listed in a corpus directory's index.txt, with their file names
+static bool loadCorpus(const std::string& dir, std::vector<Layout>& layouts, std::vector<std::string>& files) {
+	std::ifstream index((dir + "/index.txt").c_str());
+	if(!index.good()) {
+		std::cerr << "Could not open " << dir << "/index.txt" << std::endl;
+		return false;
+	}
+	std::string line;
+	while(std::getline(index, line)) {
+		if(line.empty() || line[0] == '#') continue;
+		std::istringstream iss(line);
+		std::string file;
+		if(!(iss >> file)) continue;
+		Layout layout;
+		int height;
+		loadTypesGrid(dir + "/" + file, layout.types, layout.width, height);
+		if(height != 6 || layout.width < 3 || layout.width > 9 || (int)layout.types.size() != layout.width * height) {
+			std::cerr << "Invalid grid in " << file << std::endl;
+			return false;
+		}
+		layouts.push_back(layout);
+		files.push_back(file);
+	}
+	return true;
+}
+
+
+/***** Shrinking *****/
+
+static ComponentType simplerType(ComponentType type) {
+	switch(type) {
+		case QUAD_URANIUM_CELL: return DUAL_URANIUM_CELL;
+		case DUAL_URANIUM_CELL: return URANIUM_CELL;
+		case ADVANCED_HEAT_VENT: case REACTOR_HEAT_VENT: case OVERCLOCKED_HEAT_VENT: return HEAT_VENT;
+		case ADVANCED_HEAT_EXCHANGER: case CORE_HEAT_EXCHANGER: case COMPONENT_HEAT_EXCHANGER: return HEAT_EXCHANGER;
+		case COOLANT_CELL_60: return COOLANT_CELL_30;
+		case COOLANT_CELL_30: return COOLANT_CELL_10;
+		case CONDENSATOR_LZH: return CONDENSATOR_RSH;
+		case THICK_NEUTRON_REFLECTOR: return NEUTRON_REFLECTOR;
+		case CONTAINMENT_REACTOR_PLATING: case HEAT_CAPACITY_REACTOR_PLATING: return REACTOR_PLATING;
+		default: return COMPONENT_NONE;
+	}
+}
+
+static Layout dropLastColumn(const Layout& layout) {
+	Layout smaller;
+	smaller.width = layout.width - 1;
+	for(int y = 0; y < 6; ++y) {
+		for(int x = 0; x < smaller.width; ++x) smaller.types.push_back(layout.types[y * layout.width + x]);
+	}
+	return smaller;
+}
+
+// Greedily removes columns, removes components and downgrades components while the mismatch persists
+static Layout shrinkLayout(Layout layout, const char* onlyEngine, bool ticks, bool symmetry) {
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		while(layout.width > 3) {
+			Layout smaller = dropLastColumn(layout);
+			if(checkLayout(smaller, onlyEngine, ticks, symmetry).empty()) break;
+			layout = smaller;
+			changed = true;
+		}
+		for(size_t i = 0; i < layout.types.size(); ++i) {
+			if(layout.types[i] == COMPONENT_NONE) continue;
+			ComponentType candidates[2] = { COMPONENT_NONE, simplerType(layout.types[i]) };
+			for(int c = 0; c < 2; ++c) {
+				if(c == 1 && candidates[c] == COMPONENT_NONE) break;
+				Layout candidate = layout;
+				candidate.types[i] = candidates[c];
+				if(!checkLayout(candidate, onlyEngine, ticks, symmetry).empty()) {
+					layout = candidate;
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+	return layout;
+}
+
+
+int main(int argc, char** argv) {
+	long count = 10000;
+	unsigned int seed = 1;
+	bool ticks = false;
+	bool symmetry = false;
+	const char* onlyEngine = 0;
+	const char* corpusDir = 0;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--count" && i + 1 < argc) count = atol(argv[++i]);
+		else if(arg == "--seed" && i + 1 < argc) seed = strtoul(argv[++i], 0, 10);
+		else if(arg == "--engine" && i + 1 < argc) onlyEngine = argv[++i];
+		else if(arg == "--ticks") ticks = true;
+		else if(arg == "--symmetry") symmetry = true;
+		else if(arg == "--brute-force-cycles" && i + 1 < argc) bruteForceCycles = atoi(argv[++i]);
+		else if(arg == "--corpus" && i + 1 < argc) corpusDir = argv[++i];
+		else {
+			std::cerr << "Usage: reactorsim-verify [--count n] [--seed s] [--ticks] [--symmetry] [--engine name] [--brute-force-cycles n] [--corpus dir]" << std::endl;
+			return 2;
+		}
+	}
+	for(const Engine& engine : engines) {
+		if(bruteForceCycles <= engine.maxCycles) {
+			std::cerr << "--brute-force-cycles must be more than the " << engine.maxCycles << " cycles of " << engine.name << std::endl;
+			return 2;
+		}
+	}
+	std::vector<Layout> corpus;
+	std::vector<std::string> corpusFiles;
+	if(corpusDir && !loadCorpus(corpusDir, corpus, corpusFiles)) return 2;
+
+	std::mt19937 rng(seed);
+	long numUnverified = 0;
+	for(long n = 0; n < (long)corpus.size() + count; ++n) {
+		bool inCorpus = n < (long)corpus.size();
+		Layout layout = inCorpus ? corpus[n] : generateLayout(rng);
+		bool unverified = false;
+		std::string mismatch = checkLayout(layout, onlyEngine, ticks, symmetry, &unverified);
+		if(unverified) numUnverified++;
+		if(mismatch.empty()) continue;
+
+		if(inCorpus) std::cout << "Mismatch on " << corpusFiles[n] << ": " << mismatch << std::endl;
+		else std::cout << "Mismatch on layout " << n - corpus.size() << " (seed " << seed << "): " << mismatch << std::endl;
+		layout = shrinkLayout(layout, onlyEngine, ticks, symmetry);
+		std::cout << "Minimal counterexample (" << checkLayout(layout, onlyEngine, ticks, symmetry) << "):" << std::endl;
+		printTypesGrid(layout.types, layout.width, 6);
+		std::cout << "\nReference:" << std::endl;
+		printSimResults(runReference(layout));
+		for(const Engine& engine : engines) {
+			if(onlyEngine && strcmp(onlyEngine, engine.name)) continue;
+			std::cout << "\n" << engine.name << ":" << std::endl;
+			printSimResults(engine.run(layout));
+		}
+		return 1;
+	}
+	std::cout << corpus.size() + count - numUnverified << " layouts verified";
+	if(numUnverified) std::cout << ", " << numUnverified << " unverified (more than " << bruteForceCycles << " cycles)";
+	std::cout << std::endl;
+	return 0;
+}